@@ -11,11 +11,13 @@
 Node::Node(yyltype loc) {
     location = new yyltype(loc);
     parent = NULL;
+    scope = NULL;
 }
 
 Node::Node() {
     location = NULL;
     parent = NULL;
+    scope = NULL;
 }
 
 Location * Node::GetTmpLocation(const char *key) {
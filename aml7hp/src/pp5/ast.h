@@ -48,7 +48,8 @@ class ClassLookup {
     Hashtable <int *> * fields;
     Hashtable <char *> * types;
     Hashtable <int *> * methods;
-    ClassLookup() {fieldCount = 0; methodCount = 0; fields = new Hashtable<int *>; methods = new Hashtable<int *>; methodNames = new List<const char *>; types = new Hashtable <char *>;}
+    const char * superclass; // name of the class extended, or NULL
+    ClassLookup() {fieldCount = 0; methodCount = 0; fields = new Hashtable<int *>; methods = new Hashtable<int *>; methodNames = new List<const char *>; types = new Hashtable <char *>; superclass = NULL;}
 };
 
 extern Hashtable<ClassLookup *> * classLookups;
@@ -57,7 +58,7 @@ class Scope {
   public:
     Hashtable <Location *> * symtab;
     Scope * parent;
-    Scope() { symtab = new Hashtable<Location*>; }
+    Scope() { symtab = new Hashtable<Location*>; parent = NULL; }
 };
 
 class Node 
@@ -65,6 +65,7 @@ void ClassDecl::EnterScope() {
 
 void ClassDecl::BuildLookups() {
     ClassLookup * classLookup = this->CreateClassLookup();
+    if (extends) classLookup->superclass = extends->id->name;
     classLookups->Enter(this->id->name, classLookup);
 }
 
@@ -175,9 +176,9 @@ void FnDecl::Emit() {
 
     char * label = this->id->name;
     ClassDecl * parentClass;
+    char temp [100];
 
     if (parentClass = dynamic_cast<ClassDecl *>(this->parent)) {
-        char temp [100];
         sprintf(temp, "_%s.%s", parentClass->id->name, this->id->name);
         label = temp;
     }
@@ -189,17 +190,16 @@ void FnDecl::Emit() {
     generator->GenLabel(label);
 
     BeginFunc * begin = generator->GenBeginFunc();
+    begin->SetNumParams(formals->NumElements() + (parentClass ? 1 : 0));
 
     for (int i=0; i < formals->NumElements(); i++) {
         VarDecl * decl = dynamic_cast<VarDecl *>(formals->Nth(i));
-        char temp[10];
         Location * loc;
-        sprintf(temp, "%s", decl->id->name);
         int offset = generator->OffsetToFirstParam + ((i) * generator->VarSize);
         if (parentClass) {
             offset = offset + 4;
         }
-        loc = new Location(fpRelative, offset, temp);
+        loc = new Location(fpRelative, offset, decl->id->name);
         ArrayType * array = dynamic_cast<ArrayType *>(decl->type);
         NamedType * object = dynamic_cast<NamedType *>(decl->type);
         if (array) {
@@ -213,6 +213,7 @@ void FnDecl::Emit() {
     }
 
     if (body) body->Emit();
+    generator->GenErrorStubs();
 
     begin->SetFrameSize(generator->localCount * generator->VarSize);
 
@@ -9,6 +9,18 @@
 #include "errors.h"
 
 
+void Expr::EvalJump(const char *trueLabel, const char *falseLabel) {
+    Assert(trueLabel != NULL || falseLabel != NULL);
+    Location * cond = this->Eval();
+    if (falseLabel) {
+        generator->GenIfZ(cond, falseLabel);
+        if (trueLabel) generator->GenGoto(trueLabel);
+    }
+    else {
+        generator->GenIfCmp("!=", cond, generator->GenLoadConstant(0), trueLabel);
+    }
+}
+
 IntConstant::IntConstant(yyltype loc, int val) : Expr(loc) {
     value = val;
 }
@@ -83,56 +95,103 @@ Location * ArithmeticExpr::Eval() {
 }
 
 Location * RelationalExpr::Eval() {
-    Location * loc;
-    if (strcmp(op->tokenString, ">=") == 0) {
-        loc = generator->GenBinaryOp("||", generator->GenBinaryOp("<", right->Eval(), left->Eval()), generator->GenBinaryOp("==", left->Eval(), right->Eval()));
-    }
-    else if (strcmp(op->tokenString, "<=") == 0) {
-        loc = generator->GenBinaryOp("||", generator->GenBinaryOp("<", left->Eval(), right->Eval()), generator->GenBinaryOp("==", left->Eval(), right->Eval()));
-    }
-    else if (strcmp(op->tokenString, ">") == 0) {
-        loc = generator->GenBinaryOp("<", right->Eval(), left->Eval());
-    }
-    else {
-        loc = generator->GenBinaryOp(op->tokenString, left->Eval(), right->Eval());
-    }
+    Location * l = left->Eval();
+    Location * r = right->Eval();
+    Location * loc = generator->GenBinaryOp(op->tokenString, l, r);
     loc->SetType("bool");
     return loc;
 } 
 
+static bool IsString(Location *loc) {
+    return loc->GetType() && strcmp(loc->GetType(), "string") == 0;
+}
+
+// Branches on the relation between two values the way EvalJump is asked to
+static void GenRelationJump(const char *relation, Location *l, Location *r,
+                            const char *trueLabel, const char *falseLabel) {
+    if (falseLabel) {
+        IfCmp::Relation negated = IfCmp::Negate(IfCmp::RelationForName(relation));
+        generator->GenIfCmp(IfCmp::relationName[negated], l, r, falseLabel);
+        if (trueLabel) generator->GenGoto(trueLabel);
+    }
+    else {
+        generator->GenIfCmp(relation, l, r, trueLabel);
+    }
+}
+
+void RelationalExpr::EvalJump(const char *trueLabel, const char *falseLabel) {
+    Location * l = left->Eval();
+    Location * r = right->Eval();
+    GenRelationJump(op->tokenString, l, r, trueLabel, falseLabel);
+}
+
 Location * EqualityExpr::Eval() {
     Location * loc;
-    if (strcmp(op->tokenString, "!=") == 0) {
-        loc = generator->GenBinaryOp("||", generator->GenBinaryOp("<", right->Eval(), left->Eval()), generator->GenBinaryOp("<", left->Eval(), right->Eval()));
+    Location * l = left->Eval();
+    Location * r = right->Eval();
+    if (IsString(l) && IsString(r)) {
+        loc = generator->GenBuiltInCall(StringEqual, l, r);
+        if (strcmp(op->tokenString, "!=") == 0) {
+            loc = generator->GenUnaryOp("!", loc);
+        }
     }
     else {
-        Location * l = left->Eval();
-        Location * r = right->Eval();
-        if ((strcmp(l->GetType(), "string") == 0) && (strcmp(r->GetType(), "string") == 0)) {
-            loc = generator->GenBuiltInCall(StringEqual, l, r);
-        }
-        else {
-            loc = generator->GenBinaryOp(op->tokenString, left->Eval(), right->Eval());
-        }
+        loc = generator->GenBinaryOp(op->tokenString, l, r);
     }
     loc->SetType("bool");
     return loc;
 } 
 
+void EqualityExpr::EvalJump(const char *trueLabel, const char *falseLabel) {
+    Location * l = left->Eval();
+    Location * r = right->Eval();
+    if (IsString(l) && IsString(r)) {
+        Location * equal = generator->GenBuiltInCall(StringEqual, l, r);
+        Location * zero = generator->GenLoadConstant(0);
+        const char * relation = strcmp(op->tokenString, "==") == 0 ? "!=" : "==";
+        GenRelationJump(relation, equal, zero, trueLabel, falseLabel);
+    }
+    else {
+        GenRelationJump(op->tokenString, l, r, trueLabel, falseLabel);
+    }
+}
+
 Location * LogicalExpr::Eval() {
     Location * loc;
     if (strcmp(op->tokenString, "!") == 0) {
-        Location * two = generator->GenLoadConstant(2);
-        Location * one = generator->GenLoadConstant(1);
-        loc = generator->GenBinaryOp("%", generator->GenBinaryOp("+", right->Eval(), one), two);
+        loc = generator->GenUnaryOp("!", right->Eval());
     }
     else {
-        loc = generator->GenBinaryOp(op->tokenString, left->Eval(), right->Eval());
+        // the right operand is only evaluated if the left doesn't decide
+        char * doneLabel = generator->NewLabel();
+        loc = generator->GenTempVar();
+        generator->GenAssign(loc, generator->GenLoadConstant(0));
+        this->EvalJump(NULL, doneLabel);
+        generator->GenAssign(loc, generator->GenLoadConstant(1));
+        generator->GenLabel(doneLabel);
     }
     loc->SetType("bool");
     return loc;
 } 
 
+void LogicalExpr::EvalJump(const char *trueLabel, const char *falseLabel) {
+    if (strcmp(op->tokenString, "!") == 0) {
+        right->EvalJump(falseLabel, trueLabel);
+    }
+    else if (strcmp(op->tokenString, "&&") == 0) {
+        char * leftFalse = falseLabel ? (char *)falseLabel : generator->NewLabel();
+        left->EvalJump(NULL, leftFalse);
+        right->EvalJump(trueLabel, falseLabel);
+        if (!falseLabel) generator->GenLabel(leftFalse);
+    }
+    else {
+        char * leftTrue = trueLabel ? (char *)trueLabel : generator->NewLabel();
+        left->EvalJump(leftTrue, NULL);
+        right->EvalJump(trueLabel, falseLabel);
+        if (!trueLabel) generator->GenLabel(leftTrue);
+    }
+}
+
 ArrayAccess::ArrayAccess(yyltype loc, Expr *b, Expr *s) : LValue(loc) {
     (base=b)->SetParent(this); 
     (subscript=s)->SetParent(this);
@@ -147,12 +206,9 @@ Location * ArrayAccess::Eval(bool returnAddr) {
     Location * arr = base->Eval();
     Location * zero = generator->GenLoadConstant(0);
     Location * length = generator->GenLoad(arr);
-    char * isInRange = generator->NewLabel();
-    generator->GenIfZ(generator->GenBinaryOp("||", generator->GenBinaryOp("||", generator->GenBinaryOp("<", length, index), generator->GenBinaryOp("==", length, index)), generator->GenBinaryOp("<", index, zero)), isInRange);
-    Location * error = generator->GenLoadConstant(err_arr_out_of_bounds);
-    generator->GenBuiltInCall(PrintString, error);
-    generator->GenBuiltInCall(Halt);
-    generator->GenLabel(isInRange);
+    const char * outOfBounds = generator->ErrorStub(err_arr_out_of_bounds);
+    generator->GenIfCmp(">=", index, length, outOfBounds);
+    generator->GenIfCmp("<", index, zero, outOfBounds);
     Location * varSize = generator->GenLoadConstant(generator->VarSize);
     Location * offset = generator->GenBinaryOp("*", index, varSize);
     Location * loc = generator->GenBinaryOp("+", arr, offset);
@@ -200,10 +256,13 @@ Location * FieldAccess::Eval(bool returnAddr) {
             classInfo = classLookups->Lookup(baseLoc->GetType());
         }
     
-        Location * offset = generator->GenLoadConstant(*(classInfo->fields->Lookup(field->name)));
-        Location * loc = generator->GenBinaryOp("+", baseLoc, offset);
-        if (!returnAddr) {
-            loc = generator->GenLoad(loc, 4);
+        int fieldOffset = *(classInfo->fields->Lookup(field->name));
+        Location * loc;
+        if (returnAddr) {
+            loc = generator->GenBinaryOp("+", baseLoc, generator->GenLoadConstant(fieldOffset));
+        }
+        else {
+            loc = generator->GenLoad(baseLoc, fieldOffset + 4);
             loc->SetType(classInfo->types->Lookup(field->name));
             char * temp = new char[100];
             sprintf(temp, "%s_elem", field->name);
@@ -223,8 +282,34 @@ Call::Call(yyltype loc, Expr *b, Identifier *f, List<Expr*> *a) : Expr(loc)  {
     (actuals=a)->SetParentAll(this);
 }
 
+// Class hierarchy analysis: returns the label of the method that every
+// object of static class classInfo dispatches to for name, or NULL if
+// the class or one of its subclasses overrides it and a vtable lookup
+// is needed.
+static const char * OnlyImplementation(ClassLookup * classInfo, const char * name) {
+    int index = *classInfo->methods->Lookup(name) / generator->VarSize;
+    const char * label = classInfo->methodNames->Nth(index);
+    Iterator<ClassLookup *> iter = classLookups->GetIterator();
+    ClassLookup * other;
+    while ((other = iter.GetNextValue()) != NULL) {
+        ClassLookup * up = other;
+        while (up && up != classInfo)
+            up = up->superclass ? classLookups->Lookup(up->superclass) : NULL;
+        if (up && strcmp(other->methodNames->Nth(index), label) != 0)
+            return NULL;
+    }
+    return label;
+}
+
+// Evaluates the actuals into args, last one first (each has to be in a
+// variable before any is pushed since nothing may come between the
+// pushes and the call)
+void Call::EvalActuals(List<Location*> *args) {
+    for (int i = actuals->NumElements() - 1; i >= 0; i--)
+        args->InsertAt(actuals->Nth(i)->Eval(), 0);
+}
+
 Location * Call::Eval() {
-    Expr * arg;
     Location * loc;
     ClassLookup * classInfo = NULL;
     Location * baseLoc = NULL;
@@ -264,18 +349,25 @@ Location * Call::Eval() {
             if (classInfo == NULL) {
                 classInfo = classLookups->Lookup(baseLoc->GetType());
             }
-            Location * firstFuncAddr = generator->GenLoad(baseLoc);
-            int * num = classInfo->methods->Lookup(field->name);
-            Location * offset = generator->GenLoadConstant(*num);
-            Location * funcAddr = generator->GenBinaryOp("+", firstFuncAddr, offset);
-            Location * func = generator->GenLoad(funcAddr);
-            for (int i=actuals->NumElements() -1; i >= 0; i--) {
-                arg = actuals->Nth(i);
-                loc = arg->Eval();
-                generator->GenPushParam(loc);
+            const char * method = OnlyImplementation(classInfo, field->name);
+            Location * func = NULL;
+            if (!method) {
+                Location * firstFuncAddr = generator->GenLoad(baseLoc);
+                int * num = classInfo->methods->Lookup(field->name);
+                func = generator->GenLoad(firstFuncAddr, *num);
             }
+            List<Location*> args;
+            EvalActuals(&args);
+            for (int i = args.NumElements() - 1; i >= 0; i--)
+                generator->GenPushParam(args.Nth(i));
             generator->GenPushParam(baseLoc);
-            Location * loc = generator->GenACall(func, true);
+            Location * loc;
+            if (method) {
+                loc = generator->GenLCall(method, true);
+                generator->GenPopParams(generator->VarSize * (args.NumElements() + 1));
+            } else {
+                loc = generator->GenACall(func, true);
+            }
             loc->SetType(classInfo->types->Lookup(field->name));
             char * temp = new char[100];
             sprintf(temp, "%s_elem", field->name);
@@ -285,11 +377,10 @@ Location * Call::Eval() {
     }
 
     classInfo = classLookups->Lookup("&global");
-    for (int i=actuals->NumElements() -1; i >= 0; i--) {
-        arg = actuals->Nth(i);
-        loc = arg->Eval();
-        generator->GenPushParam(loc);
-    }
+    List<Location*> args;
+    EvalActuals(&args);
+    for (int i = args.NumElements() - 1; i >= 0; i--)
+        generator->GenPushParam(args.Nth(i));
     loc = generator->GenLCall(field->name, true);
     generator->GenPopParams(generator->VarSize * actuals->NumElements());
     char * funcType = classInfo->types->Lookup(field->name);
@@ -348,9 +439,7 @@ Location * This::Eval() {
 }
 
 Location * NullConstant::Eval() {
-    Location * word = generator->GenLoadConstant(4);
-    Location * mem = generator->GenBuiltInCall(Alloc, word);
-    return mem;
+    return generator->GenLoadConstant(0);
 }
 
 
@@ -362,13 +451,8 @@ NewArrayExpr::NewArrayExpr(yyltype loc, Expr *sz, Type *et) : Expr(loc) {
 
 Location * NewArrayExpr::Eval() {
     Location * arrLength = size->Eval();
-    char * okayLabel = generator->NewLabel();
     Location * zero = generator->GenLoadConstant(0);
-    generator->GenIfZ(generator->GenBinaryOp("<", arrLength, zero), okayLabel);
-    Location * error = generator->GenLoadConstant(err_arr_bad_size);
-    generator->GenBuiltInCall(PrintString, error);
-    generator->GenBuiltInCall(Halt);
-    generator->GenLabel(okayLabel);
+    generator->GenIfCmp("<", arrLength, zero, generator->ErrorStub(err_arr_bad_size));
     Location * one = generator->GenLoadConstant(1);
     Location * length = generator->GenBinaryOp("+", one, arrLength);
     Location * varSize = generator->GenLoadConstant(generator->VarSize);
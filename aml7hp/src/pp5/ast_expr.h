@@ -27,6 +27,11 @@ class Expr : public Stmt
     Expr(yyltype loc) : Stmt(loc) {}
     Expr() : Stmt() {}
     virtual Location * Eval() {return NULL;}
+
+        // Emits the expression as a condition: jumps to trueLabel if it
+        // holds and to falseLabel if not. Either label (but not both)
+        // may be NULL to fall through in that case instead.
+    virtual void EvalJump(const char *trueLabel, const char *falseLabel);
 };
 
 /* This node type is used for those places where an expression is optional.
@@ -45,6 +50,7 @@ class IntConstant : public Expr
   public:
     IntConstant(yyltype loc, int val);
     Location * Eval();
+    int GetValue() const { return value; }
 };
 
 class DoubleConstant : public Expr 
@@ -117,6 +123,7 @@ class RelationalExpr : public CompoundExpr
   public:
     RelationalExpr(Expr *lhs, Operator *op, Expr *rhs) : CompoundExpr(lhs,op,rhs) {}
     Location * Eval();
+    void EvalJump(const char *trueLabel, const char *falseLabel);
 };
 
 class EqualityExpr : public CompoundExpr 
@@ -125,6 +132,7 @@ class EqualityExpr : public CompoundExpr
     EqualityExpr(Expr *lhs, Operator *op, Expr *rhs) : CompoundExpr(lhs,op,rhs) {}
     const char *GetPrintNameForNode() { return "EqualityExpr"; }
     Location * Eval();
+    void EvalJump(const char *trueLabel, const char *falseLabel);
 };
 
 class LogicalExpr : public CompoundExpr 
@@ -134,6 +142,7 @@ class LogicalExpr : public CompoundExpr
     LogicalExpr(Operator *op, Expr *rhs) : CompoundExpr(op,rhs) {}
     const char *GetPrintNameForNode() { return "LogicalExpr"; }
     Location * Eval();
+    void EvalJump(const char *trueLabel, const char *falseLabel);
 };
 
 class AssignExpr : public CompoundExpr 
@@ -195,6 +204,8 @@ class Call : public Expr
     Expr *base;	// will be NULL if no explicit base
     Identifier *field;
     List<Expr*> *actuals;
+
+    void EvalActuals(List<Location*> *args);
     
   public:
     Call(yyltype loc, Expr *base, Identifier *field, List<Expr*> *args);
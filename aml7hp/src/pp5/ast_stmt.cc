@@ -94,7 +94,7 @@ void ForStmt::Emit() {
 
     init->Eval();
     generator->GenLabel(loopLabel);
-    generator->GenIfZ(test->Eval(), continueLabel);
+    test->EvalJump(NULL, continueLabel);
     body->Emit();
     step->Eval();
     generator->GenGoto(loopLabel);
@@ -111,8 +111,7 @@ void WhileStmt::Emit() {
     this->breakLabel = continueLabel;
 
     generator->GenLabel(loopLabel);
-    Location * cond = test->Eval();
-    generator->GenIfZ(cond, continueLabel);
+    test->EvalJump(NULL, continueLabel);
     body->Emit();
     generator->GenGoto(loopLabel);
     generator->GenLabel(continueLabel);
@@ -126,13 +125,12 @@ IfStmt::IfStmt(Expr *t, Stmt *tb, Stmt *eb): ConditionalStmt(t, tb) {
 
 void IfStmt::Emit() {
     this->scope = this->parent->scope;
-    Location * cond = test->Eval();
     char * ifZLabel = generator->NewLabel();;
     char * continueLabel = ifZLabel;
     if (elseBody) {
         continueLabel = generator->NewLabel();
     }
-    generator->GenIfZ(cond, ifZLabel); 
+    test->EvalJump(NULL, ifZLabel);
     body->Emit();
     generator->GenGoto(continueLabel);
     if (elseBody) {
@@ -143,6 +141,52 @@ void IfStmt::Emit() {
 }
 
 
+CaseStmt::CaseStmt(IntConstant *v, List<Stmt*> *s) {
+    Assert(s != NULL); // value is NULL for default
+    value = v;
+    if (value) value->SetParent(this);
+    (stmts=s)->SetParentAll(this);
+}
+
+void CaseStmt::Emit() {
+    this->scope = this->parent->scope;
+    generator->GenLabel(label);
+    for(int i=0; i < stmts->NumElements(); i++) {
+        stmts->Nth(i)->Emit();
+    }
+}
+
+SwitchStmt::SwitchStmt(Expr *t, List<CaseStmt*> *c) {
+    Assert(t != NULL && c != NULL);
+    (test=t)->SetParent(this);
+    (cases=c)->SetParentAll(this);
+}
+
+void SwitchStmt::Emit() {
+    this->scope = this->parent->scope;
+    this->breakLabel = generator->NewLabel();
+
+    Location * value = test->Eval();
+    std::map<int, const char*> labels;
+    const char * defaultLabel = breakLabel;
+    for (int i=0; i < cases->NumElements(); i++) {
+        CaseStmt * c = cases->Nth(i);
+        c->label = generator->NewLabel();
+        if (!c->GetValue()) {
+            defaultLabel = c->label;
+        }
+        else if (!labels.count(c->GetValue()->GetValue())) {
+            labels[c->GetValue()->GetValue()] = c->label;
+        }
+    }
+    generator->GenSwitch(value, labels, defaultLabel);
+    for (int i=0; i < cases->NumElements(); i++) {
+        cases->Nth(i)->Emit();
+    }
+    generator->GenLabel(breakLabel);
+}
+
+
 ReturnStmt::ReturnStmt(yyltype loc, Expr *e) : Stmt(loc) { 
     Assert(e != NULL);
     (expr=e)->SetParent(this);
@@ -158,6 +202,11 @@ void BreakStmt::Emit() {
     while(node) {
         if (loopStmt = dynamic_cast<LoopStmt*>(node)) {
             generator->GenGoto(loopStmt->breakLabel);
+            return;
+        }
+        if (SwitchStmt * switchStmt = dynamic_cast<SwitchStmt*>(node)) {
+            generator->GenGoto(switchStmt->breakLabel);
+            return;
         }
         node = node->parent;
     }
@@ -19,6 +19,7 @@
 class Decl;
 class VarDecl;
 class Expr;
+class IntConstant;
 class ClassDecl;
   
 class Program : public Node
@@ -100,6 +101,31 @@ class IfStmt : public ConditionalStmt
     void Emit();
 };
 
+class CaseStmt : public Stmt
+{
+  protected:
+    IntConstant *value; // NULL for the default case
+    List<Stmt*> *stmts;
+
+  public:
+    char * label;
+    CaseStmt(IntConstant *value, List<Stmt*> *statements);
+    IntConstant *GetValue() { return value; }
+    void Emit();
+};
+
+class SwitchStmt : public Stmt
+{
+  protected:
+    Expr *test;
+    List<CaseStmt*> *cases;
+
+  public:
+    char * breakLabel;
+    SwitchStmt(Expr *test, List<CaseStmt*> *cases);
+    void Emit();
+};
+
 class BreakStmt : public Stmt 
 {
   public:
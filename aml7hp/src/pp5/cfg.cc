@@ -0,0 +1,254 @@
+/* File: cfg.cc
+ * ------------
+ * Implementation of the FlowGraph class.
+ */
+
+#include "cfg.h"
+#include "utility.h"
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+
+FlowGraph::FlowGraph(Iterator begin, Iterator end) : haveLiveness(false)
+{
+  std::map<std::string, BasicBlock*> labels;
+  BasicBlock *cur = NULL;
+  for (Iterator p = begin; p != end; ++p) {
+    if (!cur || dynamic_cast<Label*>(*p)) { // leader
+      cur = new BasicBlock(blocks.size(), p);
+      blocks.push_back(cur);
+    }
+    if (Label *l = dynamic_cast<Label*>(*p))
+      labels[l->text()] = cur;
+    cur->end = p;
+    ++cur->end;
+
+    List<Location*> used;
+    (*p)->GetUses(&used);
+    if ((*p)->GetDst()) used.Append((*p)->GetDst());
+    for (int i = 0; i < used.NumElements(); i++)
+      if (used.Nth(i)->GetSegment() == fpRelative)
+        vars[used.Nth(i)->GetOffset()] = used.Nth(i);
+
+    if (BranchTarget(*p) || EndsFlow(*p))
+      cur = NULL;
+  }
+
+  for (unsigned i = 0; i < blocks.size(); i++) {
+    BasicBlock *b = blocks[i];
+    std::vector<const char*> names;
+    std::vector<BasicBlock*> targets;
+    BranchTargets(b->Last(), &names);
+    for (unsigned j = 0; j < names.size(); j++) {
+      Assert(labels.count(names[j]));
+      targets.push_back(labels[names[j]]);
+    }
+    if (!EndsFlow(b->Last()) && i + 1 < blocks.size())
+      targets.push_back(blocks[i + 1]);
+    for (unsigned j = 0; j < targets.size(); j++) {
+      // IfZ to the next block, JumpTable entries with the same target
+      if (std::find(targets.begin(), targets.begin() + j, targets[j]) != targets.begin() + j)
+        continue;
+      b->succs.push_back(targets[j]);
+      targets[j]->preds.push_back(b);
+    }
+  }
+
+  std::vector<BasicBlock*> stack;
+  if (!blocks.empty()) {
+    blocks[0]->reachable = true;
+    stack.push_back(blocks[0]);
+  }
+  while (!stack.empty()) {
+    BasicBlock *b = stack.back();
+    stack.pop_back();
+    for (unsigned i = 0; i < b->succs.size(); i++)
+      if (!b->succs[i]->reachable) {
+        b->succs[i]->reachable = true;
+        stack.push_back(b->succs[i]);
+      }
+  }
+}
+
+FlowGraph::~FlowGraph()
+{
+  for (unsigned i = 0; i < blocks.size(); i++)
+    delete blocks[i];
+  for (unsigned i = 0; i < loops.size(); i++)
+    delete loops[i];
+}
+
+
+const char *FlowGraph::BranchTarget(Instruction *instr)
+{
+  if (Goto *g = dynamic_cast<Goto*>(instr)) return g->branch_label();
+  if (IfZ *ifz = dynamic_cast<IfZ*>(instr)) return ifz->branch_label();
+  if (IfCmp *ifcmp = dynamic_cast<IfCmp*>(instr)) return ifcmp->branch_label();
+  return NULL;
+}
+
+void FlowGraph::BranchTargets(Instruction *instr, std::vector<const char*> *targets)
+{
+  if (JumpTable *table = dynamic_cast<JumpTable*>(instr))
+    targets->insert(targets->end(), table->GetTargets().begin(), table->GetTargets().end());
+  else if (const char *target = BranchTarget(instr))
+    targets->push_back(target);
+}
+
+void FlowGraph::Retarget(Instruction *instr, const char *label, const char *with)
+{
+  const char *target = BranchTarget(instr);
+  if (JumpTable *table = dynamic_cast<JumpTable*>(instr))
+    table->ReplaceTarget(label, with);
+  else if (target && strcmp(target, label) == 0)
+    instr->ReplaceLabel(with);
+}
+
+bool FlowGraph::EndsFlow(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  ACall *acall = dynamic_cast<ACall*>(instr);
+  return dynamic_cast<Goto*>(instr) || dynamic_cast<Return*>(instr)
+      || dynamic_cast<EndFunc*>(instr) || dynamic_cast<JumpTable*>(instr)
+      || (call && (call->IsTail() || strcmp(call->GetLabel(), "_Halt") == 0))
+      || (acall && acall->IsTail());
+}
+
+
+void FlowGraph::StepBackward(Instruction *instr, std::set<int> *live)
+{
+  Location *dst = instr->GetDst();
+  if (dst && dst->GetSegment() == fpRelative)
+    live->erase(dst->GetOffset());
+  List<Location*> uses;
+  instr->GetUses(&uses);
+  for (int i = 0; i < uses.NumElements(); i++)
+    if (uses.Nth(i)->GetSegment() == fpRelative)
+      live->insert(uses.Nth(i)->GetOffset());
+}
+
+void FlowGraph::ComputeLiveness()
+{
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = blocks.size() - 1; i >= 0; i--) {
+      BasicBlock *b = blocks[i];
+      std::set<int> live;
+      for (unsigned s = 0; s < b->succs.size(); s++)
+        live.insert(b->succs[s]->liveIn.begin(), b->succs[s]->liveIn.end());
+      if (live != b->liveOut) {
+        b->liveOut = live;
+        changed = true;
+      }
+      for (Iterator p = b->end; p != b->begin; )
+        StepBackward(*--p, &live);
+      if (live != b->liveIn) {
+        b->liveIn = live;
+        changed = true;
+      }
+    }
+  }
+  haveLiveness = true;
+}
+
+
+static bool SmallerLoop(Loop *a, Loop *b)
+{
+  return a->body.size() < b->body.size();
+}
+
+void FlowGraph::FindLoops()
+{
+  std::set<int> all;
+  for (unsigned i = 0; i < blocks.size(); i++)
+    if (blocks[i]->reachable) all.insert(i);
+  for (unsigned i = 1; i < blocks.size(); i++)
+    blocks[i]->dominators = all;
+  if (!blocks.empty()) blocks[0]->dominators.insert(0);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned i = 1; i < blocks.size(); i++) {
+      BasicBlock *b = blocks[i];
+      if (!b->reachable) continue;
+      std::set<int> dom = all;
+      for (unsigned j = 0; j < b->preds.size(); j++) {
+        if (!b->preds[j]->reachable) continue;
+        std::set<int> meet;
+        std::set_intersection(dom.begin(), dom.end(), b->preds[j]->dominators.begin(),
+                              b->preds[j]->dominators.end(), std::inserter(meet, meet.begin()));
+        dom.swap(meet);
+      }
+      dom.insert(i);
+      if (dom != b->dominators) {
+        b->dominators.swap(dom);
+        changed = true;
+      }
+    }
+  }
+
+  std::map<BasicBlock*, Loop*> byHeader;
+  for (unsigned i = 0; i < blocks.size(); i++) {
+    BasicBlock *latch = blocks[i];
+    if (!latch->reachable) continue;
+    for (unsigned j = 0; j < latch->succs.size(); j++) {
+      BasicBlock *header = latch->succs[j];
+      if (!latch->DominatedBy(header)) continue;
+      Loop *loop = byHeader[header];
+      if (!loop) {
+        loop = byHeader[header] = new Loop(header);
+        loop->body.insert(header);
+        loops.push_back(loop);
+      }
+      loop->latches.push_back(latch);
+      std::vector<BasicBlock*> stack(1, latch);
+      while (!stack.empty()) {
+        BasicBlock *b = stack.back();
+        stack.pop_back();
+        if (!b->reachable || !loop->body.insert(b).second) continue;
+        stack.insert(stack.end(), b->preds.begin(), b->preds.end());
+      }
+    }
+  }
+  std::stable_sort(loops.begin(), loops.end(), SmallerLoop);
+}
+
+
+std::string FlowGraph::NamesOf(const std::set<int> &live)
+{
+  std::string names;
+  for (std::set<int>::const_iterator v = live.begin(); v != live.end(); ++v) {
+    names += " ";
+    names += vars[*v]->GetName();
+  }
+  return names;
+}
+
+void FlowGraph::Print(const char *key)
+{
+  if (!IsDebugOn(key)) return;
+  for (unsigned i = 0; i < blocks.size(); i++) {
+    BasicBlock *b = blocks[i];
+    std::string edges;
+    char buf[32];
+    for (unsigned j = 0; j < b->preds.size(); j++) {
+      sprintf(buf, " B%d", b->preds[j]->id);
+      edges += buf;
+    }
+    edges += " ->";
+    for (unsigned j = 0; j < b->succs.size(); j++) {
+      sprintf(buf, " B%d", b->succs[j]->id);
+      edges += buf;
+    }
+    PrintDebug(key, "B%d:%s%s", b->id, edges.c_str(), b->reachable ? "" : " (unreachable)");
+    if (haveLiveness)
+      PrintDebug(key, "live in:%s", NamesOf(b->liveIn).c_str());
+    for (Iterator p = b->begin; p != b->end; ++p)
+      (*p)->Print();
+    if (haveLiveness)
+      PrintDebug(key, "live out:%s", NamesOf(b->liveOut).c_str());
+  }
+}
@@ -0,0 +1,101 @@
+/* File: cfg.h
+ * -----------
+ * The FlowGraph class divides the Tac instructions of one function
+ * (BeginFunc through EndFunc) into basic blocks linked by their control
+ * flow edges, and can compute which frame variables are live on entry to
+ * and exit from each block. The graph refers into the instruction list
+ * and is not kept up to date as the list is edited, so a pass builds a
+ * new one whenever it needs the current picture.
+ *
+ * Liveness is only tracked for variables in the stack frame, identified
+ * by their fp offset. Globals are always considered live.
+ *
+ * The graph can also find the dominators of each block and from them
+ * the natural loops: a back edge is one whose target dominates its
+ * source, and the loop is the target (the header) with every block that
+ * reaches the source without passing through the header.
+ */
+
+#ifndef _H_cfg
+#define _H_cfg
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "tac.h"
+
+class BasicBlock {
+  public:
+    typedef std::list<Instruction*>::iterator Iterator;
+
+    int id;                        // position in FlowGraph::blocks
+    Iterator begin, end;           // its instructions are [begin, end)
+    std::vector<BasicBlock*> succs, preds;
+    std::set<int> liveIn, liveOut; // fp offsets of live variables
+    std::set<int> dominators;      // ids of the blocks dominating this one
+    bool reachable;
+
+    BasicBlock(int n, Iterator first) : id(n), begin(first), end(first), reachable(false) {}
+    bool DominatedBy(BasicBlock *b) { return dominators.count(b->id) > 0; }
+    Instruction *Last() { Iterator last = end; return *--last; }
+};
+
+class Loop {
+  public:
+    BasicBlock *header;
+    std::set<BasicBlock*> body;       // includes the header
+    std::vector<BasicBlock*> latches; // sources of the back edges
+
+    Loop(BasicBlock *h) : header(h) {}
+    bool Contains(BasicBlock *b) { return body.count(b) > 0; }
+};
+
+class FlowGraph {
+  public:
+    typedef std::list<Instruction*>::iterator Iterator;
+
+    std::vector<BasicBlock*> blocks; // in code order, blocks[0] is the entry
+    std::vector<Loop*> loops;        // innermost (smallest) first
+
+    FlowGraph(Iterator begin, Iterator end);
+    ~FlowGraph();
+
+         // Fills in liveIn/liveOut of every block by iterating the backward
+         // dataflow equations to a fixed point
+    void ComputeLiveness();
+
+         // Updates live, the set of variables live after instr, to the
+         // set live before it (kills its destination, adds its uses)
+    static void StepBackward(Instruction *instr, std::set<int> *live);
+
+         // Fills in the dominators of every reachable block, then finds
+         // the natural loops. Back edges to the same header make one loop.
+    void FindLoops();
+
+         // Prints the blocks, their edges and (if computed) liveness under
+         // the given debug key
+    void Print(const char *key);
+
+         // Returns the label a branch instruction jumps to, or NULL if
+         // instr is not a branch (or is a JumpTable, which has several)
+    static const char *BranchTarget(Instruction *instr);
+
+         // Appends every label instr may jump to, including all entries
+         // of a JumpTable, and makes instr jump to with wherever it
+         // jumped to label
+    static void BranchTargets(Instruction *instr, std::vector<const char*> *targets);
+    static void Retarget(Instruction *instr, const char *label, const char *with);
+
+         // True if control never goes on to the next instruction
+    static bool EndsFlow(Instruction *instr);
+
+  private:
+    std::map<int, Location*> vars; // for printing variable names
+    bool haveLiveness;
+
+    std::string NamesOf(const std::set<int> &live);
+};
+
+#endif
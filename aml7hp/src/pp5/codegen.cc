@@ -9,11 +9,13 @@
 #include <string.h>
 #include "tac.h"
 #include "mips.h"
+#include "optimizer.h"
 
 Location* CodeGenerator::ThisPtr= new Location(fpRelative, 4, "this");
   
 CodeGenerator::CodeGenerator()
 {
+  localCount = globalCount = 0;
 }
 
 char *CodeGenerator::NewLabel()
@@ -35,13 +37,13 @@ Location *CodeGenerator::GenTempVar(bool isGlobal)
   Location * result;
   sprintf(temp, "_tmp%d", nextTempNum++);
   if (isGlobal) {
-    this->globalCount++;
     int offset = this->OffsetToFirstGlobal + (this->globalCount * this->VarSize);
+    this->globalCount++;
     result = new Location(gpRelative, offset, temp);
   }
   else {
-    this->localCount++;
     int offset = this->OffsetToFirstLocal - (this->localCount * this->VarSize);
+    this->localCount++;
     result = new Location(fpRelative, offset, temp);
   }
   /* pp5: need to create variable in proper location
@@ -103,6 +105,14 @@ Location *CodeGenerator::GenBinaryOp(const char *opName, Location *op1,
 }
 
 
+Location *CodeGenerator::GenUnaryOp(const char *opName, Location *op)
+{
+  Location *result = GenTempVar();
+  code.push_back(new UnaryOp(UnaryOp::OpCodeForName(opName), result, op));
+  return result;
+}
+
+
 void CodeGenerator::GenLabel(const char *label)
 {
   code.push_back(new Label(label));
@@ -113,6 +123,12 @@ void CodeGenerator::GenIfZ(Location *test, const char *label)
   code.push_back(new IfZ(test, label));
 }
 
+void CodeGenerator::GenIfCmp(const char *relation, Location *op1,
+                             Location *op2, const char *label)
+{
+  code.push_back(new IfCmp(IfCmp::RelationForName(relation), op1, op2, label));
+}
+
 void CodeGenerator::GenGoto(const char *label)
 {
   code.push_back(new Goto(label));
@@ -124,6 +140,51 @@ void CodeGenerator::GenReturn(Location *val)
 }
 
 
+void CodeGenerator::GenJumpTable(Location *index, const std::vector<const char*> &targets)
+{
+  code.push_back(new JumpTable(index, targets));
+}
+
+void CodeGenerator::GenSwitch(Location *test, const std::map<int, const char*> &cases,
+                              const char *defaultLabel)
+{
+  CaseList sorted(cases.begin(), cases.end());
+  GenSwitchRange(test, sorted, 0, sorted.size(), defaultLabel);
+}
+
+// Dispatches on the cases [first, last) of the sorted list
+void CodeGenerator::GenSwitchRange(Location *test, const CaseList &cases,
+                                   int first, int last, const char *defaultLabel)
+{
+  int n = last - first;
+  if (n == 0) {
+    GenGoto(defaultLabel);
+    return;
+  }
+  int low = cases[first].first, high = cases[last - 1].first;
+  long long span = (long long)high - low + 1;
+  if (n >= MinJumpTableCases && span <= 2LL * n) {
+    std::vector<const char*> targets(span, defaultLabel);
+    for (int i = first; i < last; i++)
+      targets[cases[i].first - low] = cases[i].second;
+    GenIfCmp("<", test, GenLoadConstant(low), defaultLabel);
+    GenIfCmp(">", test, GenLoadConstant(high), defaultLabel);
+    GenJumpTable(low ? GenBinaryOp("-", test, GenLoadConstant(low)) : test, targets);
+  } else if (n <= MaxLinearCases) {
+    for (int i = first; i < last; i++)
+      GenIfCmp("==", test, GenLoadConstant(cases[i].first), cases[i].second);
+    GenGoto(defaultLabel);
+  } else {
+    int middle = first + n/2;
+    char *upper = NewLabel();
+    GenIfCmp(">=", test, GenLoadConstant(cases[middle].first), upper);
+    GenSwitchRange(test, cases, first, middle, defaultLabel);
+    GenLabel(upper);
+    GenSwitchRange(test, cases, middle, last, defaultLabel);
+  }
+}
+
+
 BeginFunc *CodeGenerator::GenBeginFunc()
 {
   BeginFunc *result = new BeginFunc;
@@ -136,6 +197,27 @@ void CodeGenerator::GenEndFunc()
   code.push_back(new EndFunc());
 }
 
+const char *CodeGenerator::ErrorStub(const char *message)
+{
+  if (!errorStubs.count(message))
+    errorStubs[message] = NewLabel();
+  return errorStubs[message];
+}
+
+void CodeGenerator::GenErrorStubs()
+{
+  if (errorStubs.empty())
+    return;
+  GenReturn(); // the stubs are only reached by branching to them
+  std::map<std::string, const char*>::iterator i;
+  for (i = errorStubs.begin(); i != errorStubs.end(); ++i) {
+    GenLabel(i->second);
+    GenBuiltInCall(PrintString, GenLoadConstant(i->first.c_str()));
+    GenBuiltInCall(Halt);
+  }
+  errorStubs.clear();
+}
+
 void CodeGenerator::GenPushParam(Location *param)
 {
   code.push_back(new PushParam(param));
@@ -204,6 +286,8 @@ void CodeGenerator::GenVTable(const char *className, List<const char *> *methodL
 
 void CodeGenerator::DoFinalCodeGen()
 {
+  Optimizer(code).Optimize();
+
   if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
     std::list<Instruction*>::iterator p;
     for (p= code.begin(); p != code.end(); ++p) {
@@ -213,8 +297,17 @@ void CodeGenerator::DoFinalCodeGen()
      Mips mips;
      mips.EmitPreamble();
 
-    std::list<Instruction*>::iterator p;
+    std::list<Instruction*>::iterator p, prev;
+    for (p= code.begin(); p != code.end(); prev = p++) {
+      if (dynamic_cast<BeginFunc*>(*p) && p != code.begin())
+        mips.AddDecafFunction(dynamic_cast<Label*>(*prev)->text());
+    }
     for (p= code.begin(); p != code.end(); ++p) {
+      if (dynamic_cast<BeginFunc*>(*p)) { // allocate registers for the whole function
+        std::list<Instruction*>::iterator end = p;
+        while (!dynamic_cast<EndFunc*>(*end)) ++end;
+        mips.AllocateRegisters(p, ++end);
+      }
       (*p)->Emit(&mips);
     }
   }
@@ -16,6 +16,9 @@
 
 #include <cstdlib>
 #include <list>
+#include <map>
+#include <string>
+#include <vector>
 #include "tac.h"
  
 
@@ -26,6 +29,11 @@ typedef enum { Alloc, ReadLine, ReadInteger, StringEqual,
 class CodeGenerator {
   private:
     std::list<Instruction*> code;
+    std::map<std::string, const char*> errorStubs; // message -> stub label
+
+    typedef std::vector<std::pair<int, const char*> > CaseList;
+    void GenSwitchRange(Location *test, const CaseList &cases, int first,
+                        int last, const char *defaultLabel);
 
 
   public:
@@ -55,7 +63,7 @@ class CodeGenerator {
     
          // Assigns a new unique label name and returns it. Does not
          // generate any Tac instructions (see GenLabel below if needed)
-    char *NewLabel();
+    static char *NewLabel();
 
     
          // Creates and returns a Location for a new uniquely named
@@ -103,6 +111,9 @@ class CodeGenerator {
          // was stored.
     Location *GenBinaryOp(const char *opName, Location *op1, Location *op2);
 
+         // Same for the unary ops, i.e. "!"
+    Location *GenUnaryOp(const char *opName, Location *op);
+
     
          // Generates the Tac instruction for pushing a single
          // parameter. Used to set up for ACall and LCall instructions.
@@ -138,7 +149,9 @@ class CodeGenerator {
          // fewer than 2 args to pass. The method returns a Location
          // for the new temp var holding the result.  For those
          // built-ins with no return value (Print/Halt), no temporary
-         // is created and NULL is returned.
+         // is created and NULL is returned. The ones that only wrap a
+         // syscall are done in place by the Mips code (see
+         // Mips::IsIntrinsic), without a call or stack space.
     Location *GenBuiltInCall(BuiltIn b, Location *arg1 = NULL, Location *arg2 = NULL);
 
     
@@ -148,16 +161,38 @@ class CodeGenerator {
          // (or omit arg) to GenReturn for a return that does not
          // return a value
     void GenIfZ(Location *test, const char *label);
+    void GenIfCmp(const char *relation, Location *op1, Location *op2,
+                  const char *label);
     void GenGoto(const char *label);
     void GenReturn(Location *val = NULL);
     void GenLabel(const char *label);
 
+         // Generates the dispatch of a switch: a jump to the label of
+         // the case whose value test holds, or to defaultLabel. A run of
+         // at least MinJumpTableCases values filling at least half of
+         // their range is looked up in a jump table, anything sparser is
+         // searched by a balanced binary tree of IfCmps, ending in a
+         // few tests for equality.
+    static const int MinJumpTableCases = 4, MaxLinearCases = 3;
+    void GenSwitch(Location *test, const std::map<int, const char*> &cases,
+                   const char *defaultLabel);
+    void GenJumpTable(Location *index, const std::vector<const char*> &targets);
+
 
          // These methods generate the Tac instructions that mark the start
          // and end of a function/method definition. 
     BeginFunc *GenBeginFunc();
     void GenEndFunc();
 
+         // Runtime checks in a function branch to an error stub that
+         // prints the message and halts. ErrorStub returns the label of
+         // the current function's stub for message (all checks that
+         // report it share one), and GenErrorStubs emits the stubs
+         // behind a return once the function body has been generated,
+         // before its frame size is set.
+    const char *ErrorStub(const char *message);
+    void GenErrorStubs();
+
              // Generates the Tac instructions for defining vtable for a
          // The methods parameter is expected to contain the vtable
          // methods in the order they should be laid out.  The vtable
@@ -167,10 +202,11 @@ class CodeGenerator {
 
 
          // Emits the final "object code" for the program by
-         // translating the sequence of Tac instructions into their mips
+         // running the Tac through the Optimizer, then translating the
+         // sequence of Tac instructions into their mips
          // equivalent and printing them out to stdout. If the debug
          // flag tac is on (-d tac), it will not translate to MIPS,
-         // but instead just print the untranslated Tac. It may be
+         // but instead just print the optimized Tac. It may be
          // useful in debugging to first make sure your Tac is correct.
     void DoFinalCodeGen();
 };
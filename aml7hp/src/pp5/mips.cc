@@ -18,11 +18,31 @@
  * Specifically, it always loads operands off stacks, and stores the
  * result back.  This breaks bad code immediately, theoretically helping
  * students.
+ *
+ * Register allocation: before a function is emitted, AllocateRegisters
+ * computes the live interval of every variable in its frame and assigns
+ * registers by linear scan. Variables that stay live across a call get
+ * a callee-saved $s register (saved and restored by the prologue and
+ * epilogue), the others prefer the caller-saved $t registers. Only when
+ * the registers run out is a variable spilled, and then it lives in its
+ * stack slot for the whole function, moving through the scratch
+ * registers rs/rt/rd as before. Globals always stay in memory.
+ * Locals that always hold the same constant are encoded as immediate
+ * operands wherever MIPS has a form for it (see ImmediateOperand), and
+ * are only loaded into a register if some use still needs one.
+ * Multiplication, division and remainder by a constant become shifts
+ * and adds, or a multiply by a reciprocal, in place of mul, div and rem.
+ * Printing an int or string, reading an int and halting are done with
+ * a syscall right where the builtin is called (see EmitLCall).
  */
 
 #include "mips.h"
+#include "cfg.h"
 #include <stdarg.h>
 #include <cstring>
+#include <climits>
+#include <string>
+#include <algorithm>
 
 
 
@@ -46,7 +66,7 @@ static bool LocationsAreSame(Location *var1, Location *var2)
 void Mips::SpillRegister(Location *dst, Register reg)
 {
   Assert(dst);
-  const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[frameReg].name : regs[gp].name;
   Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
        dst->GetOffset(), offsetFromWhere, dst->GetName(), regs[reg].name,
@@ -61,7 +81,7 @@ void Mips::SpillRegister(Location *dst, Register reg)
 void Mips::FillRegister(Location *src, Register reg)
 {
   Assert(src);
-  const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[frameReg].name : regs[gp].name;
   Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
        src->GetOffset(), offsetFromWhere, src->GetName(), regs[reg].name,
@@ -69,6 +89,52 @@ void Mips::FillRegister(Location *src, Register reg)
 }
 
 
+/* Method: GetRegister
+ * --------------------
+ * Returns the register the allocator assigned to var for the current
+ * instruction, or zero if var lives in memory (globals and spilled
+ * variables). The regs[] descriptors are kept up to date by
+ * UpdateRegisterContents as each instruction is emitted.
+ */
+Mips::Register Mips::GetRegister(Location *var)
+{
+  if (var->GetSegment() != fpRelative)
+    return zero;
+  for (int i = 0; i < NumRegs; i++)
+    if (regs[i].isGeneralPurpose && regs[i].var
+	&& regs[i].var == var)
+      return (Register)i;
+  return zero;
+}
+
+/* Methods: GetRegisterForRead, GetRegisterForWrite, CommitWrite
+ * -------------------------------------------------------------
+ * Covers used by the Emit methods. A variable with a register is used
+ * in place. Otherwise the scratch register is filled from (read) or
+ * later spilled to (CommitWrite) the variable's home in memory.
+ */
+Mips::Register Mips::GetRegisterForRead(Location *var, Register scratch)
+{
+  Register reg = GetRegister(var);
+  if (reg != zero)
+    return reg;
+  FillRegister(var, scratch);
+  return scratch;
+}
+
+Mips::Register Mips::GetRegisterForWrite(Location *var, Register scratch)
+{
+  Register reg = GetRegister(var);
+  return (reg != zero) ? reg : scratch;
+}
+
+void Mips::CommitWrite(Location *var, Register reg)
+{
+  if (GetRegister(var) != reg)
+    SpillRegister(var, reg);
+}
+
+
 /* Method: Emit
  * ------------
  * General purpose helper used to emit assembly instructions in
@@ -99,10 +165,13 @@ void Mips::Emit(const char *fmt, ...)
  */
 void Mips::EmitLoadConstant(Location *dst, int val)
 {
-  Register r = rd; 
+  int unused;
+  if (IsConstant(dst, &unused) && !constantNeedsRegister[dst])
+    return; // every use is an immediate
+  Register r = GetRegisterForWrite(dst, rd);
   Emit("li %s, %d\t\t# load constant value %d into %s", regs[r].name,
 	 val, val, regs[r].name);
-  SpillRegister(dst, rd);
+  CommitWrite(dst, r);
 }
 
 /* Method: EmitLoadStringConstant
@@ -131,8 +200,9 @@ void Mips::EmitLoadStringConstant(Location *dst, const char *str)
  */
 void Mips::EmitLoadLabel(Location *dst, const char *label)
 {
-  Emit("la %s, %s\t# load label", regs[rd].name, label);
-  SpillRegister(dst, rd);
+  Register r = GetRegisterForWrite(dst, rd);
+  Emit("la %s, %s\t# load label", regs[r].name, label);
+  CommitWrite(dst, r);
 }
  
 
@@ -144,8 +214,12 @@ void Mips::EmitLoadLabel(Location *dst, const char *label)
  */
 void Mips::EmitCopy(Location *dst, Location *src)
 {
-  FillRegister(src, rd);
-  SpillRegister(dst, rd);
+  Register from = GetRegisterForRead(src, rd);
+  Register to = GetRegisterForWrite(dst, rd);
+  if (to != from)
+    Emit("move %s, %s\t\t# copy %s to %s", regs[to].name, regs[from].name,
+	 src->GetName(), dst->GetName());
+  CommitWrite(dst, to);
 }
 
 
@@ -159,10 +233,11 @@ void Mips::EmitCopy(Location *dst, Location *src)
  */
 void Mips::EmitLoad(Location *dst, Location *reference, int offset)
 {
-  FillRegister(reference, rs);
-  Emit("lw %s, %d(%s) \t# load with offset", regs[rd].name,
-	 offset, regs[rs].name);
-  SpillRegister(dst, rd);
+  Register ref = GetRegisterForRead(reference, rs);
+  Register r = GetRegisterForWrite(dst, rd);
+  Emit("lw %s, %d(%s) \t# load with offset", regs[r].name,
+	 offset, regs[ref].name);
+  CommitWrite(dst, r);
 }
 
 
@@ -176,10 +251,10 @@ void Mips::EmitLoad(Location *dst, Location *reference, int offset)
  */
 void Mips::EmitStore(Location *reference, Location *value, int offset)
 {
-  FillRegister(value, rs);
-  FillRegister(reference, rd);
+  Register val = GetRegisterForRead(value, rs);
+  Register ref = GetRegisterForRead(reference, rd);
   Emit("sw %s, %d(%s) \t# store with offset",
-	 regs[rs].name, offset, regs[rd].name);
+	 regs[val].name, offset, regs[ref].name);
 }
 
 
@@ -194,11 +269,206 @@ void Mips::EmitStore(Location *reference, Location *value, int offset)
 void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst, 
 				 Location *op1, Location *op2)
 {
-  FillRegister(op1, rs);
-  FillRegister(op2, rt);
-  Emit("%s %s, %s, %s\t", NameForTac(code), regs[rd].name,
-	 regs[rs].name, regs[rt].name);
-  SpillRegister(dst, rd);
+  int imm, which = ImmediateOperand(currentInstruction, &imm);
+  if (which) {
+    Register r1 = GetRegisterForRead(which == 2 ? op1 : op2, rs);
+    Register r = GetRegisterForWrite(dst, rd);
+    const char *d = regs[r].name, *s = regs[r1].name;
+    if (which == 1) code = BinaryOp::Mirror(code); // now s code imm
+    switch (code) {
+      case BinaryOp::Add: Emit("addi %s, %s, %d", d, s, imm); break;
+      case BinaryOp::Sub:
+	if (which == 2) Emit("addi %s, %s, %d", d, s, -imm);
+	else Emit("sub %s, $zero, %s", d, s);
+	break;
+      case BinaryOp::Mul: EmitMultiplyByConstant(r, r1, imm); break;
+      case BinaryOp::Div:
+      case BinaryOp::Mod: EmitDivideByConstant(code, r, r1, imm); break;
+      case BinaryOp::Less: Emit("slti %s, %s, %d", d, s, imm); break;
+      case BinaryOp::Le:   Emit("slti %s, %s, %d", d, s, imm + 1); break;
+      case BinaryOp::Gt:
+	if (imm == 0) {
+	  Emit("slt %s, $zero, %s", d, s);
+	  break;
+	}
+	Emit("slti %s, %s, %d", d, s, imm + 1);
+	Emit("xori %s, %s, 1", d, d);
+	break;
+      case BinaryOp::Ge:
+	Emit("slti %s, %s, %d", d, s, imm);
+	Emit("xori %s, %s, 1", d, d);
+	break;
+      case BinaryOp::Eq:
+      case BinaryOp::Ne:
+	if (imm != 0) {
+	  Emit("xori %s, %s, %d", d, s, imm);
+	  s = d;
+	}
+	if (code == BinaryOp::Eq) Emit("sltiu %s, %s, 1", d, s);
+	else Emit("sltu %s, $zero, %s", d, s);
+	break;
+      case BinaryOp::And: Emit("andi %s, %s, %d", d, s, imm); break;
+      case BinaryOp::Or:  Emit("ori %s, %s, %d", d, s, imm); break;
+      default: Assert(0);
+    }
+    CommitWrite(dst, r);
+    return;
+  }
+  Register r1 = GetRegisterForRead(op1, rs);
+  Register r2 = GetRegisterForRead(op2, rt);
+  Register r = GetRegisterForWrite(dst, rd);
+  Emit("%s %s, %s, %s\t", NameForTac(code), regs[r].name,
+	 regs[r1].name, regs[r2].name);
+  CommitWrite(dst, r);
+}
+
+
+// Log base 2 of a power of two
+static int Log2(unsigned n)
+{
+  int k = 0;
+  while (n > 1) { n >>= 1; k++; }
+  return k;
+}
+
+/* Method: EmitMultiplyByConstant
+ * ------------------------------
+ * Emits r = r1 * c without a mul when a shift or two will do: for c a
+ * power of two, or a sum or difference of two powers of two (such as
+ * 10 = 8 + 2 or 7 = 8 - 1), negated afterwards if c < 0. Any other
+ * constant goes through rt to a mul. r may be the same register as r1,
+ * so it is only written once r1 has been read for the last time.
+ */
+void Mips::EmitMultiplyByConstant(Register r, Register r1, int c)
+{
+  const char *d = regs[r].name, *s = regs[r1].name, *t = regs[rt].name;
+  unsigned m = c < 0 ? 0u - c : c, low = m & (0u - m);
+  if (m == 0) {
+    Emit("move %s, $zero", d);
+    return;
+  }
+  if (m == low) {
+    if (m == 1) Emit("move %s, %s", d, s);
+    else Emit("sll %s, %s, %d", d, s, Log2(m));
+  } else if (((m - low) & (m - low - 1)) == 0) {
+    Emit("sll %s, %s, %d", t, s, Log2(m - low));    // m = 2^a + 2^b
+    if (low > 1) Emit("sll %s, %s, %d", d, s, Log2(low));
+    Emit("addu %s, %s, %s", d, t, low > 1 ? d : s);
+  } else if (((m + low) & (m + low - 1)) == 0) {
+    Emit("sll %s, %s, %d", t, s, Log2(m + low));    // m = 2^a - 2^b
+    if (low > 1) Emit("sll %s, %s, %d", d, s, Log2(low));
+    Emit("subu %s, %s, %s", d, t, low > 1 ? d : s);
+  } else {
+    Emit("li %s, %d", t, c);
+    Emit("mul %s, %s, %s", d, s, t);
+    return;
+  }
+  if (c < 0) Emit("subu %s, $zero, %s", d, d);
+}
+
+/* Method: SignedMagic
+ * -------------------
+ * Finds the multiplier and shift that turn a signed division by d
+ * (2 <= |d| < 2^31) into taking the high word of a multiply, as given
+ * in Warren, Hacker's Delight, section 10-4.
+ */
+static void SignedMagic(int d, int *multiplier, int *shift)
+{
+  const unsigned two31 = 0x80000000u;
+  unsigned ad = d < 0 ? 0u - d : d;
+  unsigned t = two31 + ((unsigned)d >> 31), anc = t - 1 - t % ad;
+  unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+  unsigned q2 = two31 / ad, r2 = two31 - q2 * ad, delta;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2; r1 *= 2;
+    if (r1 >= anc) { q1++; r1 -= anc; }
+    q2 *= 2; r2 *= 2;
+    if (r2 >= ad) { q2++; r2 -= ad; }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  *multiplier = (int)(q2 + 1);
+  if (d < 0) *multiplier = -*multiplier;
+  *shift = p - 32;
+}
+
+/* Method: EmitDivideByConstant
+ * ----------------------------
+ * Emits r = r1 / c or r = r1 % c (c nonzero) without a div, keeping the
+ * signed semantics of div and rem: the quotient rounds toward zero and
+ * the remainder has the sign of the dividend. For c = +-2^k a negative
+ * dividend is first biased by 2^k - 1 so that the arithmetic shift
+ * rounds toward zero as well; the remainder is the dividend less the
+ * biased value with its low k bits cleared. Any other divisor is
+ * multiplied by its magic number (see SignedMagic), and the remainder is
+ * computed from the quotient. rt holds the intermediate values, and a
+ * second temporary is r if that is not also the dividend, else rd (free
+ * then, as r1 and r are a single allocated register).
+ */
+void Mips::EmitDivideByConstant(BinaryOp::OpCode code, Register r, Register r1, int c)
+{
+  const char *d = regs[r].name, *s = regs[r1].name, *t = regs[rt].name;
+  const char *x = regs[r != r1 ? r : rd].name;
+  bool isDiv = (code == BinaryOp::Div);
+  unsigned m = c < 0 ? 0u - c : c;
+  Assert(m != 0);
+  if (m == 1) {
+    if (!isDiv) Emit("move %s, $zero", d);
+    else if (c > 0) Emit("move %s, %s", d, s);
+    else Emit("subu %s, $zero, %s", d, s);
+    return;
+  }
+  if ((m & (m - 1)) == 0) {
+    int k = Log2(m);
+    if (k == 1) {
+      Emit("srl %s, %s, 31", t, s);
+    } else {
+      Emit("sra %s, %s, 31", t, s);
+      Emit("srl %s, %s, %d", t, t, 32 - k);
+    }
+    Emit("addu %s, %s, %s", t, s, t);
+    if (isDiv) {
+      Emit("sra %s, %s, %d", d, t, k);
+      if (c < 0) Emit("subu %s, $zero, %s", d, d);
+    } else {
+      Emit("srl %s, %s, %d", t, t, k);
+      Emit("sll %s, %s, %d", t, t, k);
+      Emit("subu %s, %s, %s", d, s, t);
+    }
+    return;
+  }
+  int magic, shift;
+  SignedMagic(c, &magic, &shift);
+  Emit("li %s, %d", t, magic);
+  Emit("mult %s, %s", s, t);
+  Emit("mfhi %s", t);
+  if (c > 0 && magic < 0) Emit("addu %s, %s, %s", t, t, s);
+  if (c < 0 && magic > 0) Emit("subu %s, %s, %s", t, t, s);
+  if (shift > 0) Emit("sra %s, %s, %d", t, t, shift);
+  Emit("srl %s, %s, 31", x, t);   // round a negative quotient up
+  if (isDiv) {
+    Emit("addu %s, %s, %s", d, t, x);
+  } else {
+    Emit("addu %s, %s, %s", t, t, x);
+    Emit("li %s, %d", x, c);
+    Emit("mul %s, %s, %s", t, t, x);
+    Emit("subu %s, %s, %s", d, s, t);
+  }
+}
+
+
+/* Method: EmitUnaryOp
+ * -------------------
+ * Booleans are 0 or 1, so a logical not only flips the low bit.
+ */
+void Mips::EmitUnaryOp(UnaryOp::OpCode code, Location *dst, Location *src)
+{
+  Assert(code == UnaryOp::Not);
+  Register r1 = GetRegisterForRead(src, rs);
+  Register r = GetRegisterForWrite(dst, rd);
+  Emit("xori %s, %s, 1\t# not", regs[r].name, regs[r1].name);
+  CommitWrite(dst, r);
 }
 
 
@@ -239,24 +509,100 @@ void Mips::EmitGoto(const char *label)
  */
 void Mips::EmitIfZ(Location *test, const char *label)
 {
-  FillRegister(test, rs);
-  Emit("beqz %s, %s\t# branch if %s is zero ", regs[rs].name, label,
+  Register r = GetRegisterForRead(test, rs);
+  Emit("beqz %s, %s\t# branch if %s is zero ", regs[r].name, label,
 	 test->GetName());
 }
 
 
+/* Method: EmitIfCmp
+ * -----------------
+ * Used for a conditional branch on the relation between two variables.
+ * Both are slaved to registers and compared by the branch instruction
+ * itself, so no boolean is ever materialized.
+ */
+void Mips::EmitIfCmp(IfCmp::Relation rel, Location *op1, Location *op2,
+		     const char *label)
+{
+  int imm, which = ImmediateOperand(currentInstruction, &imm);
+  if (which) {
+    static const IfCmp::Relation swapped[IfCmp::NumRelations] =
+      {IfCmp::Eq, IfCmp::Ne, IfCmp::Gt, IfCmp::Ge, IfCmp::Lt, IfCmp::Le};
+    if (which == 1) rel = swapped[rel];
+    Location *var = which == 2 ? op1 : op2;
+    Register r = GetRegisterForRead(var, rs);
+    if (imm == 0)
+      Emit("%s %s, $zero, %s\t# branch if %s %s 0", mipsBranchName[rel],
+	   regs[r].name, label, var->GetName(), IfCmp::relationName[rel]);
+    else
+      Emit("%s %s, %d, %s\t# branch if %s %s %d", mipsBranchName[rel],
+	   regs[r].name, imm, label, var->GetName(), IfCmp::relationName[rel], imm);
+    return;
+  }
+  Register r1 = GetRegisterForRead(op1, rs);
+  Register r2 = GetRegisterForRead(op2, rt);
+  Emit("%s %s, %s, %s\t# branch if %s %s %s", mipsBranchName[rel],
+       regs[r1].name, regs[r2].name, label, op1->GetName(),
+       IfCmp::relationName[rel], op2->GetName());
+}
+
+
+/* Method: EmitJumpTable
+ * ---------------------
+ * Used for an indexed jump. The targets are laid out as a table of
+ * words in the data segment under a unique label; the index, scaled to
+ * a word offset, selects the entry that is loaded and jumped to.
+ */
+void Mips::EmitJumpTable(Location *index, const std::vector<const char*> &targets)
+{
+  static int tableNum = 1;
+  char label[16];
+  sprintf(label, "_table%d", tableNum++);
+  Emit(".data\t\t\t# create jump table marked with label");
+  Emit(".align 2");
+  Emit("%s:", label);
+  for (unsigned i = 0; i < targets.size(); i++)
+    Emit(".word %s", targets[i]);
+  Emit(".text");
+  Register r = GetRegisterForRead(index, rs);
+  Emit("sll %s, %s, 2\t\t# scale %s to a table offset", regs[rt].name, regs[r].name,
+       index->GetName());
+  Emit("lw %s, %s(%s)\t# load jump target", regs[rt].name, label, regs[rt].name);
+  Emit("jr %s\t\t# jump through table", regs[rt].name);
+}
+
+
 /* Method: EmitParam
  * -----------------
- * Used to push a parameter on the stack in anticipation of upcoming
- * function call. Decrements the stack pointer by 4. Slaves argument into
- * register and then stores contents to location just made at end of
- * stack.
+ * Used to pass a parameter to an upcoming function call. The first
+ * parameter pushed (the last argument) makes the stack space for all of
+ * them, unless the call is a tail call or an intrinsic. An argument
+ * passed in a register is loaded straight into its $a register; the
+ * others are copied to their slot at the end of the stack.
  */
 void Mips::EmitParam(Location *arg)
 { 
-  Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
-  FillRegister(arg, rs);
-  Emit("sw %s, 4($sp)\t# copy param value to stack", regs[rs].name);
+  Assert(outgoingParams.count(currentInstruction));
+  OutgoingParam &param = outgoingParams[currentInstruction];
+  if (param.index == param.count - 1 && !param.tail && !param.intrinsic)
+    Emit("subu $sp, $sp, %d\t# decrement sp to make space for params",
+	 4*param.count);
+  Register r, to = rs;
+  if (param.inRegister && param.index < NumArgRegs)
+    to = (Register)(a0 + param.index);
+  int value;
+  if (IsConstant(arg, &value)) {
+    Emit("li %s, %d\t\t# load constant param", regs[to].name, value);
+    r = to;
+  } else {
+    r = GetRegisterForRead(arg, to);
+  }
+  if (to == rs)
+    Emit("sw %s, %d($sp)\t# copy param value to stack", regs[r].name,
+	 4*(param.index + 1));
+  else if (r != to)
+    Emit("move %s, %s\t\t# pass param in %s", regs[to].name, regs[r].name,
+	 regs[to].name);
 }
 
 
@@ -269,38 +615,85 @@ void Mips::EmitParam(Location *arg)
  * jal for a label, a jalr if address in register. Both will save the
  * return address in $ra. If there is an expected result passed, we slave
  * the var to a register and copy function return value from $v0 into that
- * register.  
+ * register.  A tail call instead pops our frame and jumps (j or jr) to
+ * the function, which then returns straight to our caller.
  */
-void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
+void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel, bool isTail)
 {
+  if (isTail) {
+    EmitPopFrame();
+    Emit("%s %-15s\t# tail call reusing our caller's frame", isLabel? "j": "jr", fn);
+    return;
+  }
   Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
   if (result != NULL) {
+    Register r = GetRegisterForWrite(result, rd);
     Emit("move %s, %s\t\t# copy function return value from $v0",
-    regs[rd].name, regs[v0].name);
-    SpillRegister(result, rd);
+    regs[r].name, regs[v0].name);
+    CommitWrite(result, r);
   }
 }
 
 
-// Two covers for the above method for specific LCall/ACall variants
-void Mips::EmitLCall(Location *dst, const char *label)
+// The builtins in defs.asm that only wrap a syscall, and its number
+static struct _intrinsic {
+  const char *label;
+  int syscall;
+} intrinsics[] =
+ {{"_PrintInt", 1},
+  {"_PrintString", 4},
+  {"_ReadInteger", 5},
+  {"_Halt", 10}};
+
+int Mips::SyscallFor(const char *label)
+{
+  for (unsigned i = 0; i < sizeof(intrinsics)/sizeof(intrinsics[0]); i++)
+    if (strcmp(intrinsics[i].label, label) == 0)
+      return intrinsics[i].syscall;
+  return 0;
+}
+
+bool Mips::IsIntrinsicCall(Instruction *instr)
+{
+  LCall *lcall = dynamic_cast<LCall*>(instr);
+  return lcall && IsIntrinsic(lcall->GetLabel());
+}
+
+// Two covers for the above method for specific LCall/ACall variants.
+// An intrinsic finds its argument already in $a0 (see EmitParam), so
+// all that is left is the syscall itself.
+void Mips::EmitLCall(Location *dst, const char *label, bool isTail)
 { 
-  EmitCallInstr(dst, label, true);
+  if (int syscall = SyscallFor(label)) {
+    Emit("li $v0, %d\t\t# syscall for %s", syscall, label);
+    Emit("syscall");
+    if (dst != NULL) {
+      Register r = GetRegisterForWrite(dst, rd);
+      Emit("move %s, $v0\t\t# copy syscall result from $v0", regs[r].name);
+      CommitWrite(dst, r);
+    }
+    return;
+  }
+  EmitCallInstr(dst, label, true, isTail);
 }
 
-void Mips::EmitACall(Location *dst, Location *fn)
+void Mips::EmitACall(Location *dst, Location *fn, bool isTail)
 {
-  FillRegister(fn, rs);
-  EmitCallInstr(dst, regs[rs].name, false);
+  Register r = GetRegisterForRead(fn, rs);
+  if (isTail && IsCalleeSaved(r)) { // restored before the jump
+    Emit("move %s, %s", regs[rs].name, regs[r].name);
+    r = rs;
+  }
+  EmitCallInstr(dst, regs[r].name, false, isTail);
 }
 
 /*
  * We remove all parameters from the stack after a completed call
- * by adjusting the stack pointer upwards.
+ * by adjusting the stack pointer upwards. An intrinsic put none there.
  */
 void Mips::EmitPopParams(int bytes)
 {
-  if (bytes != 0)
+  if (bytes != 0 && !intrinsicPops.count(currentInstruction))
     Emit("add $sp, $sp, %d\t# pop params off stack", bytes);
 }
 
@@ -318,42 +711,81 @@ void Mips::EmitPopParams(int bytes)
  * which is to remove our locals/temps from the stack, remove
  * saved registers ($fp and $ra) and restore previous values of
  * $fp and $ra so everything is returned to the state we entered.
+ * Any callee-saved registers the allocator used are restored first.
  * We then emit jr to jump to the saved $ra.
  */
  void Mips::EmitReturn(Location *returnVal)
 { 
   if (returnVal != NULL) 
     {
-      FillRegister(returnVal, rd);
+      Register r = GetRegisterForRead(returnVal, rd);
       Emit("move $v0, %s\t\t# assign return value into $v0",
-	   regs[rd].name);
+	   regs[r].name);
     }
+  EmitPopFrame();
+  Emit("jr $ra\t\t# return from function");
+}
+
+// Restores the callee-saved registers, $sp, $fp and $ra to what they
+// were on entry to the function
+void Mips::EmitPopFrame()
+{
+  if (!hasFrame)
+    return;
+  for (int i = 0; i < calleeSaved.NumElements(); i++)
+    Emit("lw %s, %d($fp)\t# restore callee-saved %s", regs[calleeSaved.Nth(i)].name,
+	 CalleeSaveOffset(i), regs[calleeSaved.Nth(i)].name);
   Emit("move $sp, $fp\t\t# pop callee frame off stack");
-  Emit("lw $ra, -4($fp)\t# restore saved ra");
+  if (!isLeaf)
+    Emit("lw $ra, -4($fp)\t# restore saved ra");
   Emit("lw $fp, 0($fp)\t# restore saved fp");
-  Emit("jr $ra\t\t# return from function");
 }
 
 
 /* Method: EmitBeginFunction
  * -------------------------
  * Used to handle the callee's part of the function call protocol
- * upon entering a new function. We decrement the $sp to make space
- * and then save the current values of $fp and $ra (since we are
- * going to change them), then set up the $fp and bump the $sp down
- * to make space for all our locals/temps.
+ * upon entering a new function. We decrement the $sp once to make
+ * space for the saved $fp and $ra and all our locals/temps, save the
+ * current values of $fp and $ra (since we are going to change them;
+ * a leaf does not change $ra) and set up the $fp. Below the locals we
+ * save the callee-saved registers the allocator handed out. A function
+ * without a frame skips all of this. Finally we set up
+ * the variables that are live on entry (parameters). One that came in an
+ * $a register is moved to its own register or else stored to its slot,
+ * and the rest are loaded from the stack if they have a register.
  */
 void Mips::EmitBeginFunction(int stackFrameSize)
 {
   Assert(stackFrameSize >= 0);
-  Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
-  Emit("sw $fp, 8($sp)\t# save fp");
-  Emit("sw $ra, 4($sp)\t# save ra");
-  Emit("addiu $fp, $sp, 8\t# set up new fp");
-
-  if (stackFrameSize != 0)
-    Emit("subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
-	   stackFrameSize);
+  localsSize = stackFrameSize;
+  int frameSize = 8 + stackFrameSize + 4*calleeSaved.NumElements();
+  if (hasFrame) {
+    Emit("subu $sp, $sp, %d\t# decrement sp to make space for ra, fp, locals/temps",
+	 frameSize);
+    Emit("sw $fp, %d($sp)\t# save fp", frameSize);
+    if (!isLeaf)
+      Emit("sw $ra, %d($sp)\t# save ra", frameSize - 4);
+    Emit("addiu $fp, $sp, %d\t# set up new fp", frameSize);
+  }
+  for (int i = 0; i < calleeSaved.NumElements(); i++)
+    Emit("sw %s, %d($fp)\t# save callee-saved %s", regs[calleeSaved.Nth(i)].name,
+	 CalleeSaveOffset(i), regs[calleeSaved.Nth(i)].name);
+  for (unsigned i = 0; i < intervals.size() && intervals[i].start == 0; i++) {
+    LiveInterval &li = intervals[i];
+    int param = (li.var->GetOffset() - 4) / 4; // params start at 4($fp)
+    if (li.var->GetSegment() == fpRelative && li.var->GetOffset() > 0
+	&& param < NumArgRegs) {
+      Register from = (Register)(a0 + param);
+      if (li.reg != zero)
+	Emit("move %s, %s\t\t# param %s passed in %s", regs[li.reg].name,
+	     regs[from].name, li.var->GetName(), regs[from].name);
+      else
+	SpillRegister(li.var, from);
+    } else if (li.reg != zero) {
+      FillRegister(li.var, li.reg);
+    }
+  }
 }
 
 
@@ -429,9 +861,19 @@ Mips::Mips() {
   mipsName[BinaryOp::Div] = "div";
   mipsName[BinaryOp::Mod] = "rem";
   mipsName[BinaryOp::Eq] = "seq";
+  mipsName[BinaryOp::Ne] = "sne";
   mipsName[BinaryOp::Less] = "slt";
+  mipsName[BinaryOp::Le] = "sle";
+  mipsName[BinaryOp::Gt] = "sgt";
+  mipsName[BinaryOp::Ge] = "sge";
   mipsName[BinaryOp::And] = "and";
   mipsName[BinaryOp::Or] = "or";
+  mipsBranchName[IfCmp::Eq] = "beq";
+  mipsBranchName[IfCmp::Ne] = "bne";
+  mipsBranchName[IfCmp::Lt] = "blt";
+  mipsBranchName[IfCmp::Le] = "ble";
+  mipsBranchName[IfCmp::Gt] = "bgt";
+  mipsBranchName[IfCmp::Ge] = "bge";
   regs[zero] = (RegContents){false, NULL, "$zero", false};
   regs[at] = (RegContents){false, NULL, "$at", false};
   regs[v0] = (RegContents){false, NULL, "$v0", false};
@@ -465,8 +907,336 @@ Mips::Mips() {
   regs[s6] = (RegContents){false, NULL, "$s6", true};
   regs[s7] = (RegContents){false, NULL, "$s7", true};
   rs = t0; rt = t1; rd = t2;
+  isLeaf = false;
+  hasFrame = true;
+  frameReg = fp;
 
 }
 const char *Mips::mipsName[BinaryOp::NumOps];
+const char *Mips::mipsBranchName[IfCmp::NumRelations];
+
 
 
+
+/* Method: UpdateRegisterContents
+ * ------------------------------
+ * Called as each instruction is emitted. Intervals are sorted by start,
+ * so we hand the register descriptors over to every interval that starts
+ * at the current instruction. Instructions outside of a function body
+ * (vtables) have no index and leave the descriptors alone.
+ */
+void Mips::UpdateRegisterContents()
+{
+  std::map<Instruction*, int>::iterator found = instrIndex.find(currentInstruction);
+  if (found == instrIndex.end())
+    return;
+  while (nextInterval < intervals.size()
+	 && intervals[nextInterval].start <= found->second) {
+    LiveInterval &li = intervals[nextInterval++];
+    if (li.reg != zero) regs[li.reg].var = li.var;
+  }
+}
+
+
+/* Method: IsConstant
+ * -------------------
+ * Returns true (and the value) if var is one of the locals found by
+ * AllocateRegisters to always hold the same constant.
+ */
+bool Mips::IsConstant(Location *var, int *value)
+{
+  if (!constants.count(var))
+    return false;
+  *value = constants[var];
+  return true;
+}
+
+/* Method: ImmediateOperand
+ * ------------------------
+ * Instruction selection for operands known to be constant. Returns 1 or
+ * 2 if that operand of the BinaryOp or IfCmp instr can be encoded in the
+ * instruction itself (setting value), or 0 if both need registers.
+ * The immediate forms are addi (which traps on overflow, as add does),
+ * andi, ori, xori+sltiu (or sltu) for == and !=, and slti for the other
+ * comparisons, followed by xori to flip the result of > and >=. A
+ * comparison with a constant first operand swaps its operands and
+ * mirrors the relation. A multiply by
+ * any constant and a division or remainder by a nonzero one are
+ * strength reduced instead (see EmitMultiplyByConstant and
+ * EmitDivideByConstant); a division by zero is left to div, which
+ * traps. A zero first operand of a subtraction is read from $zero.
+ * A constant parameter is loaded with li right where it is passed.
+ */
+int Mips::ImmediateOperand(Instruction *instr, int *value)
+{
+  if (PushParam *push = dynamic_cast<PushParam*>(instr))
+    return IsConstant(push->GetParam(), value) ? 1 : 0;
+  Location *ops[2];
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  IfCmp *cmp = dynamic_cast<IfCmp*>(instr);
+  if (op) {
+    ops[0] = op->GetOp1();
+    ops[1] = op->GetOp2();
+  } else if (cmp) {
+    ops[0] = cmp->GetOp1();
+    ops[1] = cmp->GetOp2();
+  } else {
+    return 0;
+  }
+  for (int i = 1; i >= 0; i--) { // prefer the second operand
+    int c;
+    if (!IsConstant(ops[i], &c)) continue;
+    bool first = (i == 0), fits;
+    bool signed16 = (c >= -32768 && c <= 32767), unsigned16 = (c >= 0 && c <= 65535);
+    if (cmp) {
+      fits = true; // the assembler expands large immediates
+    } else {
+      BinaryOp::OpCode code = first ? BinaryOp::Mirror(op->GetOpCode()) : op->GetOpCode();
+      switch (code) {
+	case BinaryOp::Add:  fits = signed16; break;
+	case BinaryOp::Sub:  fits = first ? c == 0 : (c > -32768 && c <= 32768); break;
+	case BinaryOp::Mul:  fits = true; break;
+	case BinaryOp::Div:
+	case BinaryOp::Mod:  fits = !first && c != 0; break;
+	case BinaryOp::Less:
+	case BinaryOp::Ge:   fits = signed16; break;
+	case BinaryOp::Le:
+	case BinaryOp::Gt:   fits = c >= -32769 && c <= 32766; break; // c + 1 is signed16
+	case BinaryOp::Eq:
+	case BinaryOp::Ne:
+	case BinaryOp::And:
+	case BinaryOp::Or:   fits = unsigned16; break;
+	default:             fits = false;
+      }
+    }
+    if (fits) {
+      *value = c;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+
+bool Mips::StartsBefore(const LiveInterval &a, const LiveInterval &b)
+{
+  return a.start < b.start || (a.start == b.start && a.end < b.end);
+}
+
+/* Method: AllocateRegisters
+ * -------------------------
+ * Runs linear-scan register allocation over the instructions of one
+ * function (BeginFunc through EndFunc). A backward liveness analysis
+ * over the instruction list gives each frame variable a live interval
+ * from the first to the last instruction where it is live; intervals
+ * are then assigned registers in order of their start points. When no
+ * suitable register is free, whichever of the current and the active
+ * intervals ends last is spilled. Variables are told apart by their
+ * Location rather than their offset, as the optimizer lets locals whose
+ * live ranges never overlap share a frame slot.
+ */
+void Mips::AllocateRegisters(std::list<Instruction*>::iterator begin,
+			     std::list<Instruction*>::iterator end)
+{
+  std::vector<Instruction*> code(begin, end);
+  int n = code.size();
+
+  // number the instructions, the labels and the frame variables
+  std::map<std::string, int> labels;
+  std::map<Location*, int> varIndex;
+  std::vector<Location*> vars;
+  std::vector<std::vector<int> > uses(n);
+  std::vector<int> defs(n, -1);
+  instrIndex.clear();
+
+  // find the locals that always hold the same constant
+  std::map<Location*, int> numDefs;
+  constants.clear();
+  constantNeedsRegister.clear();
+  for (int i = 0; i < n; i++) {
+    Location *dst = code[i]->GetDst();
+    if (!dst || dst->GetSegment() != fpRelative || dst->GetOffset() >= 0) continue;
+    numDefs[dst]++;
+    if (LoadConstant *lc = dynamic_cast<LoadConstant*>(code[i]))
+      constants[dst] = lc->GetValue();
+  }
+  for (std::map<Location*, int>::iterator i = numDefs.begin(); i != numDefs.end(); ++i)
+    if (i->second != 1) constants.erase(i->first);
+
+  for (int i = 0; i < n; i++) {
+    instrIndex[code[i]] = i;
+    if (Label *l = dynamic_cast<Label*>(code[i]))
+      labels[l->text()] = i;
+    List<Location*> used;
+    code[i]->GetUses(&used);
+    int value, immediate = ImmediateOperand(code[i], &value);
+    for (int j = 0; j < used.NumElements(); j++)
+      if (IsConstant(used.Nth(j), &value) && j != immediate - 1)
+	constantNeedsRegister[used.Nth(j)] = true;
+    if (code[i]->GetDst()) used.Append(code[i]->GetDst());
+    for (int j = 0; j < used.NumElements(); j++) {
+      Location *var = used.Nth(j);
+      if (var->GetSegment() != fpRelative || j == immediate - 1) continue;
+      if (!varIndex.count(var)) {
+	varIndex[var] = vars.size();
+	vars.push_back(var);
+      }
+      int v = varIndex[var];
+      if (j == used.NumElements() - 1 && code[i]->GetDst() == var) defs[i] = v;
+      else uses[i].push_back(v);
+    }
+  }
+
+  // number the arguments of each call, whose pushes come right before it
+  outgoingParams.clear();
+  intrinsicPops.clear();
+  for (int i = 0; i < n; i++) {
+    if (!code[i]->IsCall()) continue;
+    LCall *lcall = dynamic_cast<LCall*>(code[i]);
+    ACall *acall = dynamic_cast<ACall*>(code[i]);
+    bool intrinsic = IsIntrinsicCall(code[i]);
+    bool inRegister = !lcall || decafFunctions.count(lcall->GetLabel()) || intrinsic;
+    bool tail = lcall ? lcall->IsTail() : acall->IsTail();
+    int count = 0;
+    while (i - count > 0 && dynamic_cast<PushParam*>(code[i - count - 1]))
+      count++;
+    for (int j = 0; j < count; j++) {
+      OutgoingParam param = {j, count, inRegister, tail, intrinsic};
+      Assert(!tail || (inRegister && count <= NumArgRegs));
+      Assert(!intrinsic || count == 1);
+      outgoingParams[code[i - j - 1]] = param;
+    }
+    if (intrinsic && i + 1 < n && dynamic_cast<PopParams*>(code[i + 1]))
+      intrinsicPops.insert(code[i + 1]);
+  }
+
+  for (int i = 0; i < n; i++) { // constants never loaded are not defined
+    int value;
+    Location *dst = code[i]->GetDst();
+    if (dynamic_cast<LoadConstant*>(code[i]) && IsConstant(dst, &value)
+	&& !constantNeedsRegister[dst])
+      defs[i] = -1;
+  }
+
+  std::vector<std::vector<int> > succs(n);
+  for (int i = 0; i < n; i++) {
+    if (Goto *g = dynamic_cast<Goto*>(code[i])) {
+      succs[i].push_back(labels[g->branch_label()]);
+      continue;
+    }
+    if (JumpTable *table = dynamic_cast<JumpTable*>(code[i])) {
+      for (unsigned t = 0; t < table->GetTargets().size(); t++)
+	succs[i].push_back(labels[table->GetTargets()[t]]);
+      continue;
+    }
+    if (FlowGraph::EndsFlow(code[i]))
+      continue;
+    if (IfZ *ifz = dynamic_cast<IfZ*>(code[i]))
+      succs[i].push_back(labels[ifz->branch_label()]);
+    if (IfCmp *ifcmp = dynamic_cast<IfCmp*>(code[i]))
+      succs[i].push_back(labels[ifcmp->branch_label()]);
+    if (i + 1 < n) succs[i].push_back(i + 1);
+  }
+
+  // iterate liveIn = uses + (liveOut - defs) to a fixed point
+  int nv = vars.size();
+  std::vector<std::vector<bool> > in(n, std::vector<bool>(nv)), out(n, std::vector<bool>(nv));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = n - 1; i >= 0; i--) {
+      std::vector<bool> o(nv);
+      for (unsigned s = 0; s < succs[i].size(); s++)
+	for (int v = 0; v < nv; v++)
+	  if (in[succs[i][s]][v]) o[v] = true;
+      std::vector<bool> l = o;
+      if (defs[i] >= 0) l[defs[i]] = false;
+      for (unsigned u = 0; u < uses[i].size(); u++)
+	l[uses[i][u]] = true;
+      if (o != out[i] || l != in[i]) {
+	out[i] = o;
+	in[i] = l;
+	changed = true;
+      }
+    }
+  }
+
+  intervals.clear();
+  for (int v = 0; v < nv; v++) {
+    LiveInterval li = {vars[v], INT_MAX, -1, false, zero};
+    intervals.push_back(li);
+  }
+  for (int i = 0; i < n; i++) {
+    for (int v = 0; v < nv; v++) {
+      if (in[i][v] || out[i][v] || defs[i] == v) {
+	intervals[v].start = std::min(intervals[v].start, i);
+	intervals[v].end = std::max(intervals[v].end, i);
+      }
+      if (code[i]->IsCall() && !IsIntrinsicCall(code[i]) && out[i][v] && defs[i] != v)
+	intervals[v].crossesCall = true;
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(), StartsBefore);
+
+  // linear scan: active holds the indices of intervals owning a register
+  std::vector<int> active;
+  for (unsigned cur = 0; cur < intervals.size(); cur++) {
+    LiveInterval &li = intervals[cur];
+    if (li.end < 0) continue; // never live
+    for (unsigned a = 0; a < active.size(); )
+      if (intervals[active[a]].end < li.start) active.erase(active.begin() + a);
+      else a++;
+
+    bool taken[NumRegs] = {false};
+    for (unsigned a = 0; a < active.size(); a++)
+      taken[intervals[active[a]].reg] = true;
+    for (int r = 0; r < NumRegs && li.reg == zero; r++) {
+      Register reg = (Register)((r + t0) % NumRegs); // prefer $t over $s
+      if (!regs[reg].isGeneralPurpose || reg == rs || reg == rt || reg == rd) continue;
+      if (taken[reg] || (li.crossesCall && !IsCalleeSaved(reg))) continue;
+      li.reg = reg;
+    }
+    if (li.reg == zero) {
+      int victim = -1;
+      for (unsigned a = 0; a < active.size(); a++) {
+	LiveInterval &other = intervals[active[a]];
+	if (li.crossesCall && !IsCalleeSaved(other.reg)) continue;
+	if (other.end > li.end && (victim < 0 || other.end > intervals[victim].end))
+	  victim = active[a];
+      }
+      if (victim < 0) continue;
+      li.reg = intervals[victim].reg;
+      intervals[victim].reg = zero;
+      active.erase(std::find(active.begin(), active.end(), victim));
+    }
+    active.push_back(cur);
+  }
+
+  // callee-saved registers used anywhere need saving in the prologue
+  while (calleeSaved.NumElements() > 0) calleeSaved.RemoveAt(0);
+  for (int r = s0; r <= s7; r++)
+    for (unsigned i = 0; i < intervals.size(); i++)
+      if (intervals[i].reg == r) {
+	calleeSaved.Append((Register)r);
+	break;
+      }
+
+  // a leaf keeping nothing in memory below the $fp needs no frame
+  isLeaf = dynamic_cast<BeginFunc*>(code[0])->IsLeaf();
+  hasFrame = !isLeaf || calleeSaved.NumElements() > 0;
+  for (unsigned i = 0; i < intervals.size(); i++)
+    if (intervals[i].end >= 0 && intervals[i].reg == zero
+	&& intervals[i].var->GetOffset() < 0)
+      hasFrame = true;
+  frameReg = hasFrame ? fp : sp;
+
+  for (unsigned i = 0; i < intervals.size(); i++)
+    PrintDebug("regalloc", "%s [%d, %d]%s -> %s", intervals[i].var->GetName(),
+	       intervals[i].start, intervals[i].end,
+	       intervals[i].crossesCall ? " crosses call" : "",
+	       intervals[i].reg == zero ? "spilled" : regs[intervals[i].reg].name);
+
+  for (int i = 0; i < NumRegs; i++)
+    regs[i].var = NULL;
+  nextInterval = 0;
+}
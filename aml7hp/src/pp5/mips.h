@@ -18,6 +18,11 @@
 #ifndef _H_mips
 #define _H_mips
 
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include "tac.h"
 #include "list.h"
 class Location;
@@ -44,13 +49,77 @@ class Mips {
     void FillRegister(Location *src, Register reg);
     void SpillRegister(Location *dst, Register reg);
 
-    void EmitCallInstr(Location *dst, const char *fn, bool isL);
+        // Live range of one frame variable within the function being
+        // emitted. reg is zero if the variable was spilled to its slot.
+    struct LiveInterval {
+	Location *var;
+	int start, end;
+	bool crossesCall;
+	Register reg;
+    };
+    std::vector<LiveInterval> intervals;
+    std::map<Instruction*, int> instrIndex;
+    unsigned nextInterval;
+    List<Register> calleeSaved;
+    int localsSize;
+
+        // A leaf function (see BeginFunc) leaves $ra where it is. If it
+        // also keeps all of its locals and temps in caller-saved registers
+        // it needs no frame: $sp is left alone and stands in for $fp.
+    bool isLeaf, hasFrame;
+    Register frameReg;
+
+        // Locals whose only definition is a LoadConstant. Their uses
+        // may be encoded as immediates (or $zero) instead of taking a
+        // register; the ones with no other uses are never loaded.
+    std::map<Location*, int> constants;
+    std::map<Location*, bool> constantNeedsRegister;
+
+        // Calls between functions compiled here pass their first
+        // NumArgRegs arguments (this first for a method) in $a0-$a3. The
+        // caller still reserves stack space for all of them, with one
+        // adjustment per call, so the callee can keep a spilled parameter
+        // in its usual slot. Calls to the builtins in defs.asm pass all
+        // arguments on the stack, except for the intrinsics, which are
+        // not called at all: the argument is loaded into $a0 and the
+        // syscall the builtin would make is done in place.
+    struct OutgoingParam {
+	int index, count;  // argument number and number of arguments
+	bool inRegister;
+	bool tail;         // arguments of a tail call only go in registers
+	bool intrinsic;    // as do those of an intrinsic
+    };
+    std::map<Instruction*, OutgoingParam> outgoingParams;
+    std::set<Instruction*> intrinsicPops; // PopParams with nothing to pop
+    std::set<std::string> decafFunctions;
+
+    static bool StartsBefore(const LiveInterval &a, const LiveInterval &b);
+    bool IsCalleeSaved(Register reg) { return reg >= s0 && reg <= s7; }
+    int CalleeSaveOffset(int i) { return -8 - localsSize - 4*i; }
+    void UpdateRegisterContents();
+    Register GetRegister(Location *var);
+    Register GetRegisterForRead(Location *var, Register scratch);
+    Register GetRegisterForWrite(Location *var, Register scratch);
+    void CommitWrite(Location *var, Register reg);
+    bool IsConstant(Location *var, int *value);
+    int ImmediateOperand(Instruction *instr, int *value);
+
+    void EmitMultiplyByConstant(Register r, Register r1, int c);
+    void EmitDivideByConstant(BinaryOp::OpCode code, Register r, Register r1, int c);
+
+    void EmitCallInstr(Location *dst, const char *fn, bool isL, bool isTail);
+    static int SyscallFor(const char *label);
+    static bool IsIntrinsicCall(Instruction *instr);
+    void EmitPopFrame();
     
     static const char *mipsName[BinaryOp::NumOps];
+    static const char *mipsBranchName[IfCmp::NumRelations];
     static const char *NameForTac(BinaryOp::OpCode code);
 
     Instruction* currentInstruction;
  public:
+    static const int NumArgRegs = 4;  // arguments passed in $a0-$a3
+
     Mips();
 
     static void Emit(const char *fmt, ...);
@@ -65,24 +134,40 @@ class Mips {
 
     void EmitBinaryOp(BinaryOp::OpCode code, Location *dst, 
 			    Location *op1, Location *op2);
+    void EmitUnaryOp(UnaryOp::OpCode code, Location *dst, Location *src);
 
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
     void EmitIfZ(Location *test, const char*label);
+    void EmitIfCmp(IfCmp::Relation rel, Location *op1, Location *op2,
+		   const char *label);
+    void EmitJumpTable(Location *index, const std::vector<const char*> &targets);
     void EmitReturn(Location *returnVal);
 
     void EmitBeginFunction(int frameSize);
     void EmitEndFunction();
 
     void EmitParam(Location *arg);
-    void EmitLCall(Location *result, const char* label);
-    void EmitACall(Location *result, Location *fnAddr);
+    void EmitLCall(Location *result, const char* label, bool isTail);
+    void EmitACall(Location *result, Location *fnAddr, bool isTail);
     void EmitPopParams(int bytes);
 
     void EmitVTable(const char *label, List<const char*> *methodLabels);
 
     void EmitPreamble();
 
+        // Records that label is a function compiled to the register
+        // calling convention, must be called for all before emitting
+    void AddDecafFunction(const char *label) { decafFunctions.insert(label); }
+
+        // True for the builtins (_PrintInt, _PrintString, _ReadInteger
+        // and _Halt) whose LCall is emitted as a syscall. It leaves all
+        // registers but $v0 and $a0 alone, $ra included.
+    static bool IsIntrinsic(const char *label) { return SyscallFor(label) != 0; }
+
+    void AllocateRegisters(std::list<Instruction*>::iterator begin,
+			   std::list<Instruction*>::iterator end);
+
   
     class CurrentInstruction;
 };
@@ -96,6 +181,7 @@ public:
     : mips( mips )
   {
     mips.currentInstruction= instr;
+    mips.UpdateRegisterContents();
   }
 
   ~CurrentInstruction()
@@ -0,0 +1,2109 @@
+/* File: optimizer.cc
+ * ------------------
+ * Implementation of the Tac optimization passes.
+ */
+
+#include "optimizer.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "errors.h"
+#include "mips.h"
+#include "ranges.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+Optimizer::Optimizer(std::list<Instruction*> &c) : code(c) {}
+
+
+// A function is a leaf if the only calls it makes are tail calls or
+// calls to builtins that the Mips code does without a jal.
+static bool IsLeaf(Optimizer::Iterator begin, Optimizer::Iterator end)
+{
+  for (Optimizer::Iterator p = begin; p != end; ++p) {
+    LCall *lcall = dynamic_cast<LCall*>(*p);
+    ACall *acall = dynamic_cast<ACall*>(*p);
+    if ((lcall && !lcall->IsTail() && !Mips::IsIntrinsic(lcall->GetLabel()))
+        || (acall && !acall->IsTail()))
+      return false;
+  }
+  return true;
+}
+
+void Optimizer::Optimize()
+{
+  std::vector<Iterator> starts; // the BeginFunc of each function
+  for (Iterator p = code.begin(); p != code.end(); ++p)
+    if (dynamic_cast<BeginFunc*>(*p)) {
+      starts.push_back(p);
+      functions[FunctionName(p)] = p;
+    }
+
+  for (unsigned i = 0; i < starts.size(); i++)
+    Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (InlineCalls(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (EliminateTailCalls(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (RemoveBoundsChecks(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (HoistInvariants(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (UnrollLoops(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (ReduceInductionVariables(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+  for (unsigned i = 0; i < starts.size(); i++)
+    if (RotateLoops(starts[i], FunctionEnd(starts[i])))
+      Simplify(starts[i], FunctionEnd(starts[i]));
+
+  for (unsigned i = 0; i < starts.size(); i++) {
+    Iterator begin = starts[i], end = FunctionEnd(begin);
+    CompactFrame(begin, end, FunctionName(begin));
+    dynamic_cast<BeginFunc*>(*begin)->SetLeaf(IsLeaf(begin, end));
+    if (IsDebugOn("cfg")) {
+      PrintDebug("cfg", "function %s", FunctionName(begin));
+      FlowGraph graph(begin, end);
+      graph.ComputeLiveness();
+      graph.Print("cfg");
+    }
+  }
+}
+
+void Optimizer::Simplify(Iterator begin, Iterator end)
+{
+  bool changed;
+  do {
+    changed = FoldConstants(begin, end);
+    changed |= NumberValues(begin, end);
+    changed |= FuseBranches(begin, end);
+    changed |= CleanUpBranches(begin, end);
+    changed |= FoldAddressOffsets(begin, end);
+    changed |= RemoveDeadCode(begin, end);
+  } while (changed);
+}
+
+Optimizer::Iterator Optimizer::FunctionEnd(Iterator begin)
+{
+  Iterator end = begin;
+  while (!dynamic_cast<EndFunc*>(*end)) ++end;
+  return ++end;
+}
+
+const char *Optimizer::FunctionName(Iterator begin)
+{
+  Iterator label = begin;
+  if (label == code.begin() || !dynamic_cast<Label*>(*--label))
+    return "";
+  return dynamic_cast<Label*>(*label)->text();
+}
+
+
+// Locals and temps live below the frame pointer, params above it.
+static bool IsLocal(Location *var)
+{
+  return var->GetSegment() == fpRelative && var->GetOffset() < 0;
+}
+
+// Computes the result of an operator applied to two constants the same
+// way the MIPS instruction would. Returns false for the cases that must
+// be left to trap at runtime: an add or sub that overflows, and a
+// division by zero. mul wraps around and div does not trap on INT_MIN /
+// -1, leaving INT_MIN as the quotient and 0 as the remainder.
+static bool Evaluate(BinaryOp::OpCode code, int a, int b, int *result)
+{
+  long long wide;
+  switch (code) {
+    case BinaryOp::Add:
+    case BinaryOp::Sub:
+      wide = (code == BinaryOp::Add) ? (long long)a + b : (long long)a - b;
+      if (wide < INT_MIN || wide > INT_MAX) return false;
+      *result = (int)wide;
+      return true;
+    case BinaryOp::Mul:  *result = (int)((unsigned)a * (unsigned)b); return true;
+    case BinaryOp::Div:
+    case BinaryOp::Mod:
+      if (b == 0) return false;
+      if (a == INT_MIN && b == -1)
+        *result = (code == BinaryOp::Div) ? INT_MIN : 0;
+      else
+        *result = (code == BinaryOp::Div) ? a / b : a % b;
+      return true;
+    case BinaryOp::Eq:   *result = (a == b); return true;
+    case BinaryOp::Ne:   *result = (a != b); return true;
+    case BinaryOp::Less: *result = (a < b); return true;
+    case BinaryOp::Le:   *result = (a <= b); return true;
+    case BinaryOp::Gt:   *result = (a > b); return true;
+    case BinaryOp::Ge:   *result = (a >= b); return true;
+    case BinaryOp::And:  *result = a & b; return true;
+    case BinaryOp::Or:   *result = a | b; return true;
+    default:             return false;
+  }
+}
+
+
+// Finds the locals whose only definition in [begin, end) is a
+// LoadConstant and maps their offsets to the constant.
+static void FindConstantLocals(Optimizer::Iterator begin, Optimizer::Iterator end,
+                               std::map<int, int> *onlyValue)
+{
+  std::map<int, int> numDefs;
+  for (Optimizer::Iterator p = begin; p != end; ++p) {
+    Location *dst = (*p)->GetDst();
+    if (!dst || !IsLocal(dst)) continue;
+    numDefs[dst->GetOffset()]++;
+    LoadConstant *lc = dynamic_cast<LoadConstant*>(*p);
+    if (lc) (*onlyValue)[dst->GetOffset()] = lc->GetValue();
+  }
+  for (std::map<int, int>::iterator i = numDefs.begin(); i != numDefs.end(); ++i)
+    if (i->second != 1) onlyValue->erase(i->first);
+}
+
+// Looks up var first among the constants known in the current block,
+// then among the locals assigned a single constant in the function.
+static bool ValueOf(Location *var, std::map<int, int> &known,
+                    std::map<int, int> &onlyValue, int *value)
+{
+  if (var->GetSegment() != fpRelative) return false;
+  std::map<int, int>::iterator i = known.find(var->GetOffset());
+  if (i == known.end()) {
+    i = onlyValue.find(var->GetOffset());
+    if (i == onlyValue.end()) return false;
+  }
+  *value = i->second;
+  return true;
+}
+
+
+/* Method: FoldConstants
+ * ---------------------
+ * A frame variable's value is known at a given instruction if either it
+ * was assigned a constant earlier in the same basic block, or it is a
+ * local whose only definition in the whole function is a LoadConstant
+ * (the temps made by GenLoadConstant are all like this). A JumpTable on
+ * a known index becomes a Goto to that entry. Folding a
+ * BinaryOp can make its destination one of the latter, so the caller
+ * reruns the pass until it stops finding work.
+ */
+bool Optimizer::FoldConstants(Iterator begin, Iterator end)
+{
+  std::map<int, int> onlyValue, known;
+  FindConstantLocals(begin, end, &onlyValue);
+
+  bool changed = false;
+  for (Iterator p = begin; p != end; ) {
+    Instruction *replacement = NULL;
+    int a, b, result;
+    if (dynamic_cast<Label*>(*p)) {
+      known.clear(); // may be entered from elsewhere
+    } else if (BinaryOp *op = dynamic_cast<BinaryOp*>(*p)) {
+      if (ValueOf(op->GetOp1(), known, onlyValue, &a)
+          && ValueOf(op->GetOp2(), known, onlyValue, &b)
+          && Evaluate(op->GetOpCode(), a, b, &result))
+        replacement = new LoadConstant(op->GetDst(), result);
+    } else if (UnaryOp *op = dynamic_cast<UnaryOp*>(*p)) {
+      if (ValueOf(op->GetSrc(), known, onlyValue, &a))
+        replacement = new LoadConstant(op->GetDst(), !a);
+    } else if (Assign *assign = dynamic_cast<Assign*>(*p)) {
+      if (ValueOf(assign->GetSrc(), known, onlyValue, &a))
+        replacement = new LoadConstant(assign->GetDst(), a);
+    } else if (IfZ *ifz = dynamic_cast<IfZ*>(*p)) {
+      if (ValueOf(ifz->GetTest(), known, onlyValue, &a)) {
+        changed = true;
+        if (a != 0) { // never taken
+          p = code.erase(p);
+          continue;
+        }
+        replacement = new Goto(ifz->branch_label());
+      }
+    } else if (IfCmp *ifcmp = dynamic_cast<IfCmp*>(*p)) {
+      if (ValueOf(ifcmp->GetOp1(), known, onlyValue, &a)
+          && ValueOf(ifcmp->GetOp2(), known, onlyValue, &b)) {
+        changed = true;
+        if (!IfCmp::Holds(ifcmp->GetRelation(), a, b)) {
+          p = code.erase(p);
+          continue;
+        }
+        replacement = new Goto(ifcmp->branch_label());
+      }
+    } else if (JumpTable *table = dynamic_cast<JumpTable*>(*p)) {
+      if (ValueOf(table->GetIndex(), known, onlyValue, &a)
+          && a >= 0 && a < (int)table->GetTargets().size())
+        replacement = new Goto(table->GetTargets()[a]);
+    }
+
+    if (replacement) {
+      *p = replacement;
+      changed = true;
+    }
+    Location *dst = (*p)->GetDst();
+    if (dst && dst->GetSegment() == fpRelative) {
+      LoadConstant *lc = dynamic_cast<LoadConstant*>(*p);
+      if (lc) known[dst->GetOffset()] = lc->GetValue();
+      else known.erase(dst->GetOffset());
+    }
+    ++p;
+  }
+  return changed;
+}
+
+
+// Variables are identified by where they live, not by Location object.
+typedef std::pair<int, int> VarKey;
+
+static VarKey KeyFor(Location *var)
+{
+  return VarKey(var->GetSegment(), var->GetOffset());
+}
+
+/* Class: ValueTable
+ * -----------------
+ * The state of local value numbering within one block: the value number
+ * each variable currently holds, which variables were given each value,
+ * and the value computed by each expression seen so far. Expressions
+ * that read memory are kept apart so they can be forgotten at a Store.
+ */
+class ValueTable {
+    std::map<VarKey, int> valueOf;
+    std::map<int, std::vector<Location*> > holders;
+    std::map<std::string, int> exprs, memory;
+    int nextValue;
+
+  public:
+    ValueTable() : nextValue(0) {}
+
+    void Clear() { valueOf.clear(); holders.clear(); exprs.clear(); memory.clear(); }
+    int NewValue() { return nextValue++; }
+
+    int ValueOf(Location *var) {
+      if (!valueOf.count(KeyFor(var))) Define(var, NewValue());
+      return valueOf[KeyFor(var)];
+    }
+    void Define(Location *var, int value) {
+      valueOf[KeyFor(var)] = value;
+      holders[value].push_back(var);
+    }
+      // The first frame variable given value that still holds it, if any
+    Location *Holder(int value) {
+      std::vector<Location*> &h = holders[value];
+      for (unsigned i = 0; i < h.size(); i++)
+        if (h[i]->GetSegment() == fpRelative && valueOf[KeyFor(h[i])] == value)
+          return h[i];
+      return NULL;
+    }
+
+    bool Lookup(const std::string &key, bool readsMemory, int *value) {
+      std::map<std::string, int> &table = readsMemory ? memory : exprs;
+      if (!table.count(key)) return false;
+      *value = table[key];
+      return true;
+    }
+    void Enter(const std::string &key, bool readsMemory, int value) {
+      (readsMemory ? memory : exprs)[key] = value;
+    }
+
+    void ForgetMemory() { memory.clear(); }
+    void ForgetGlobals() {
+      std::map<VarKey, int>::iterator i = valueOf.begin();
+      while (i != valueOf.end()) {
+        if (i->first.first == gpRelative) valueOf.erase(i++);
+        else ++i;
+      }
+    }
+};
+
+static std::string KeyForLoad(int addr, int offset)
+{
+  char key[64];
+  sprintf(key, "*(%d + %d)", addr, offset);
+  return key;
+}
+
+
+/* Method: NumberValues
+ * --------------------
+ * The table is reset at each Label. It is kept across an IfZ, since the
+ * instruction following one can only be reached by falling through.
+ * Every operand is first replaced by the earliest frame variable holding
+ * the same value, which leaves many of the copies and constant temps the
+ * front end makes unread for RemoveDeadCode to delete. A BinaryOp or Load
+ * computing a value that is still held somewhere becomes an Assign. A
+ * repeated LoadConstant is left alone (it is no more expensive than the
+ * copy) but its destination is recorded as holding the earlier value.
+ */
+bool Optimizer::NumberValues(Iterator begin, Iterator end)
+{
+  ValueTable table;
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    if (dynamic_cast<Label*>(*p)) {
+      table.Clear();
+      continue;
+    }
+
+    List<Location*> uses;
+    (*p)->GetUses(&uses);
+    for (int i = 0; i < uses.NumElements(); i++) {
+      Location *holder = table.Holder(table.ValueOf(uses.Nth(i)));
+      if (holder && KeyFor(holder) != KeyFor(uses.Nth(i))) {
+        (*p)->ReplaceUse(uses.Nth(i), holder);
+        changed = true;
+      }
+    }
+
+    Location *dst = (*p)->GetDst();
+    std::string key;
+    bool readsMemory = false;
+    char buf[64];
+    if (LoadConstant *lc = dynamic_cast<LoadConstant*>(*p)) {
+      sprintf(buf, "%d", lc->GetValue());
+      key = buf;
+    } else if (LoadLabel *ll = dynamic_cast<LoadLabel*>(*p)) {
+      key = ll->GetLabel();
+    } else if (BinaryOp *op = dynamic_cast<BinaryOp*>(*p)) {
+      BinaryOp::OpCode code = op->GetOpCode();
+      int a = table.ValueOf(op->GetOp1()), b = table.ValueOf(op->GetOp2());
+      if (a > b && (code == BinaryOp::Add || code == BinaryOp::Mul || code == BinaryOp::Eq
+                    || code == BinaryOp::Ne || code == BinaryOp::And || code == BinaryOp::Or))
+        std::swap(a, b);
+      sprintf(buf, "%d %s %d", a, BinaryOp::opName[code], b);
+      key = buf;
+    } else if (UnaryOp *op = dynamic_cast<UnaryOp*>(*p)) {
+      sprintf(buf, "%s %d", UnaryOp::opName[op->GetOpCode()], table.ValueOf(op->GetSrc()));
+      key = buf;
+    } else if (Load *load = dynamic_cast<Load*>(*p)) {
+      key = KeyForLoad(table.ValueOf(load->GetSrc()), load->GetOffset());
+      readsMemory = true;
+    } else if (Assign *assign = dynamic_cast<Assign*>(*p)) {
+      table.Define(dst, table.ValueOf(assign->GetSrc()));
+      continue;
+    } else if (Store *store = dynamic_cast<Store*>(*p)) {
+      table.ForgetMemory(); // heap addresses may alias
+      table.Enter(KeyForLoad(table.ValueOf(store->GetAddr()), store->GetOffset()),
+                  true, table.ValueOf(store->GetSrc()));
+      continue;
+    } else if ((*p)->IsCall()) {
+      table.ForgetMemory();
+      table.ForgetGlobals();
+    }
+    if (!dst) continue;
+
+    int value;
+    if (key.empty()) {
+      table.Define(dst, table.NewValue());
+    } else if (table.Lookup(key, readsMemory, &value)) {
+      Location *holder = table.Holder(value);
+      if (holder && !dynamic_cast<LoadConstant*>(*p)) {
+        *p = new Assign(dst, holder);
+        changed = true;
+      }
+      table.Define(dst, value);
+    } else {
+      value = table.NewValue();
+      table.Enter(key, readsMemory, value);
+      table.Define(dst, value);
+    }
+  }
+  return changed;
+}
+
+
+/* Method: FoldAddressOffsets
+ * --------------------------
+ * Tracks, within each block, the locals computed as some variable plus
+ * a constant (field and constant-index array addresses, or chains of
+ * them) and moves that constant into the offset of the Loads and Stores
+ * that dereference them, so MIPS addressing absorbs the addition. An
+ * entry is forgotten as soon as the local or its base is reassigned.
+ */
+bool Optimizer::FoldAddressOffsets(Iterator begin, Iterator end)
+{
+  std::map<int, int> onlyValue;
+  FindConstantLocals(begin, end, &onlyValue);
+
+  std::map<int, std::pair<Location*, int> > addressOf;
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    if (dynamic_cast<Label*>(*p)) {
+      addressOf.clear();
+      continue;
+    }
+    Load *load = dynamic_cast<Load*>(*p);
+    if (load && IsLocal(load->GetSrc()) && addressOf.count(load->GetSrc()->GetOffset())) {
+      std::pair<Location*, int> addr = addressOf[load->GetSrc()->GetOffset()];
+      *p = new Load(load->GetDst(), addr.first, load->GetOffset() + addr.second);
+      changed = true;
+    }
+    Store *store = dynamic_cast<Store*>(*p);
+    if (store && IsLocal(store->GetAddr()) && addressOf.count(store->GetAddr()->GetOffset())) {
+      std::pair<Location*, int> addr = addressOf[store->GetAddr()->GetOffset()];
+      *p = new Store(addr.first, store->GetSrc(), store->GetOffset() + addr.second);
+      changed = true;
+    }
+
+    Location *dst = (*p)->GetDst();
+    if (!dst || dst->GetSegment() != fpRelative) continue;
+    std::map<int, std::pair<Location*, int> >::iterator i = addressOf.begin();
+    while (i != addressOf.end()) {
+      if (i->first == dst->GetOffset() || KeyFor(i->second.first) == KeyFor(dst))
+        addressOf.erase(i++);
+      else ++i;
+    }
+
+    BinaryOp *op = dynamic_cast<BinaryOp*>(*p);
+    if (!op || op->GetOpCode() != BinaryOp::Add || !IsLocal(dst)) continue;
+    Location *base = op->GetOp1();
+    int value;
+    std::map<int, int> none;
+    if (ValueOf(op->GetOp1(), none, onlyValue, &value)) base = op->GetOp2();
+    else if (!ValueOf(op->GetOp2(), none, onlyValue, &value)) continue;
+    if (base->GetSegment() != fpRelative || KeyFor(base) == KeyFor(dst))
+      continue; // a global base could be changed by a call
+    if (IsLocal(base) && addressOf.count(base->GetOffset())) { // chain of additions
+      std::pair<Location*, int> addr = addressOf[base->GetOffset()];
+      base = addr.first;
+      value += addr.second;
+    }
+    addressOf[dst->GetOffset()] = std::make_pair(base, value);
+  }
+  return changed;
+}
+
+
+// Counts the reads of each frame variable, by offset
+static void CountUses(Optimizer::Iterator begin, Optimizer::Iterator end,
+                      std::map<int, int> *numUses)
+{
+  for (Optimizer::Iterator p = begin; p != end; ++p) {
+    List<Location*> uses;
+    (*p)->GetUses(&uses);
+    for (int i = 0; i < uses.NumElements(); i++)
+      if (uses.Nth(i)->GetSegment() == fpRelative)
+        (*numUses)[uses.Nth(i)->GetOffset()]++;
+  }
+}
+
+/* Method: FuseBranches
+ * --------------------
+ * A comparison whose result is only used by the IfZ right after it is
+ * replaced by a single IfCmp on the opposite relation (IfZ branches
+ * when the comparison is false).
+ */
+bool Optimizer::FuseBranches(Iterator begin, Iterator end)
+{
+  std::map<int, int> numUses;
+  CountUses(begin, end, &numUses);
+
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(*p);
+    if (!op || !IsLocal(op->GetDst()) || numUses[op->GetDst()->GetOffset()] != 1)
+      continue;
+    IfCmp::Relation rel;
+    switch (op->GetOpCode()) {
+      case BinaryOp::Eq:   rel = IfCmp::Ne; break;
+      case BinaryOp::Ne:   rel = IfCmp::Eq; break;
+      case BinaryOp::Less: rel = IfCmp::Ge; break;
+      case BinaryOp::Le:   rel = IfCmp::Gt; break;
+      case BinaryOp::Gt:   rel = IfCmp::Le; break;
+      case BinaryOp::Ge:   rel = IfCmp::Lt; break;
+      default:             continue;
+    }
+    Iterator next = p;
+    IfZ *ifz = dynamic_cast<IfZ*>(*++next);
+    if (!ifz || ifz->GetTest() != op->GetDst()) continue;
+    *next = new IfCmp(rel, op->GetOp1(), op->GetOp2(), ifz->branch_label());
+    p = code.erase(p);
+    changed = true;
+  }
+  return changed;
+}
+
+
+// True if the label name is among those starting at p.
+static bool LabelsAhead(Optimizer::Iterator p, Optimizer::Iterator end, const char *name)
+{
+  for (; p != end && dynamic_cast<Label*>(*p); ++p)
+    if (strcmp(dynamic_cast<Label*>(*p)->text(), name) == 0) return true;
+  return false;
+}
+
+// Follows a jump to name on through the Gotos found right after it and
+// returns the first label of the run it ends at.
+static const char *FinalTarget(const char *name, std::map<std::string, Optimizer::Iterator> &at,
+                               std::map<std::string, const char*> &first,
+                               Optimizer::Iterator end)
+{
+  std::set<std::string> seen;
+  while (at.count(name) && seen.insert(name).second) {
+    Optimizer::Iterator p = at[name];
+    while (p != end && dynamic_cast<Label*>(*p)) ++p;
+    if (p == end || !dynamic_cast<Goto*>(*p)) break;
+    name = FlowGraph::BranchTarget(*p);
+  }
+  return at.count(name) ? first[name] : name;
+}
+
+/* Method: CleanUpBranches
+ * -----------------------
+ * Tidies the jumps the statement emitters leave behind. A run of
+ * adjacent labels is merged into its first one, a branch to a Goto is
+ * threaded on to where the Goto leads, an IfCmp that jumps over a Goto
+ * is reversed to go where the Goto did, branches to the next instruction
+ * are deleted and labels no longer branched to are dropped, joining the
+ * blocks on either side. Code left unreachable is removed by
+ * RemoveDeadCode.
+ */
+bool Optimizer::CleanUpBranches(Iterator begin, Iterator end)
+{
+  std::map<std::string, Iterator> at;       // where each label is
+  std::map<std::string, const char*> first; // the label its run starts with
+  const char *run = NULL;
+  for (Iterator p = begin; p != end; ++p) {
+    Label *label = dynamic_cast<Label*>(*p);
+    if (!label) {
+      run = NULL;
+      continue;
+    }
+    if (!run) run = label->text();
+    at[label->text()] = p;
+    first[label->text()] = run;
+  }
+
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    std::vector<const char*> targets;
+    FlowGraph::BranchTargets(*p, &targets);
+    for (unsigned i = 0; i < targets.size(); i++) {
+      const char *final = FinalTarget(targets[i], at, first, end);
+      if (strcmp(final, targets[i]) != 0) {
+        FlowGraph::Retarget(*p, targets[i], final);
+        changed = true;
+      }
+    }
+  }
+  for (Iterator p = begin; p != end; ) {
+    const char *target = FlowGraph::BranchTarget(*p);
+    Iterator next = p, after;
+    after = ++next;
+    IfCmp *cmp = dynamic_cast<IfCmp*>(*p);
+    if (cmp && next != end && dynamic_cast<Goto*>(*next) && LabelsAhead(++after, end, target)) {
+      *p = new IfCmp(IfCmp::Negate(cmp->GetRelation()), cmp->GetOp1(), cmp->GetOp2(),
+                     FlowGraph::BranchTarget(*next));
+      code.erase(next);
+      changed = true;
+    } else if (target && LabelsAhead(next, end, target)) {
+      p = code.erase(p);
+      changed = true;
+    } else {
+      ++p;
+    }
+  }
+
+  std::set<std::string> used;
+  for (Iterator p = begin; p != end; ++p) {
+    std::vector<const char*> targets;
+    FlowGraph::BranchTargets(*p, &targets);
+    used.insert(targets.begin(), targets.end());
+  }
+  for (Iterator p = begin; p != end; ) {
+    Label *label = dynamic_cast<Label*>(*p);
+    if (label && !used.count(label->text())) {
+      p = code.erase(p);
+      changed = true;
+    } else {
+      ++p;
+    }
+  }
+  return changed;
+}
+
+
+// Instructions that can be deleted when their result is not needed. A
+// division might trap, so it is kept.
+static bool HasNoSideEffects(Instruction *instr)
+{
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  if (op) return op->GetOpCode() != BinaryOp::Div && op->GetOpCode() != BinaryOp::Mod;
+  return dynamic_cast<LoadConstant*>(instr) || dynamic_cast<LoadStringConstant*>(instr)
+      || dynamic_cast<LoadLabel*>(instr) || dynamic_cast<Assign*>(instr)
+      || dynamic_cast<Load*>(instr) || dynamic_cast<UnaryOp*>(instr);
+}
+
+/* Method: RemoveDeadCode
+ * -----------------------
+ * Uses the liveness computed on the function's flow graph. Blocks that
+ * cannot be reached from the entry are deleted (keeping the EndFunc).
+ * In the others, a side-effect free instruction whose destination is
+ * not live afterwards is deleted, and a call whose result is not live
+ * is rewritten to discard it.
+ */
+bool Optimizer::RemoveDeadCode(Iterator begin, Iterator end)
+{
+  FlowGraph graph(begin, end);
+  graph.ComputeLiveness();
+
+  std::vector<Iterator> dead;
+  bool changed = false;
+  for (unsigned i = 0; i < graph.blocks.size(); i++) {
+    BasicBlock *b = graph.blocks[i];
+    if (!b->reachable) {
+      for (Iterator p = b->begin; p != b->end; ++p)
+        if (!dynamic_cast<EndFunc*>(*p)) dead.push_back(p);
+      continue;
+    }
+    std::set<int> live = b->liveOut;
+    for (Iterator p = b->end; p != b->begin; ) {
+      Instruction *instr = *--p;
+      Location *dst = instr->GetDst();
+      if (dst && dst->GetSegment() == fpRelative && !live.count(dst->GetOffset())) {
+        if (HasNoSideEffects(instr)) {
+          dead.push_back(p);
+          continue;
+        }
+        LCall *lcall = dynamic_cast<LCall*>(instr);
+        ACall *acall = dynamic_cast<ACall*>(instr);
+        if (lcall) *p = new LCall(lcall->GetLabel(), NULL);
+        if (acall) *p = new ACall(acall->GetMethodAddr(), NULL);
+        changed |= (lcall || acall);
+      }
+      FlowGraph::StepBackward(*p, &live);
+    }
+  }
+  for (unsigned i = 0; i < dead.size(); i++)
+    code.erase(dead[i]);
+  return changed || !dead.empty();
+}
+
+
+// Makes a new variable in the frame of the function starting at frame.
+static Location *NewLocal(BeginFunc *frame, const char *name)
+{
+  int offset = CodeGenerator::OffsetToFirstLocal - frame->GetFrameSize();
+  frame->SetFrameSize(frame->GetFrameSize() + CodeGenerator::VarSize);
+  return new Location(fpRelative, offset, name);
+}
+
+// Copies instr, substituting variables and labels found in the maps.
+static Instruction *CopyInstruction(Instruction *instr,
+                                    std::map<Location*, Location*> &vars,
+                                    std::map<std::string, const char*> &labels)
+{
+  Instruction *copy = instr->Clone();
+  List<Location*> uses;
+  copy->GetUses(&uses);
+  std::set<Location*> replaced;
+  for (int i = 0; i < uses.NumElements(); i++) {
+    Location *var = uses.Nth(i);
+    if (vars.count(var) && !replaced.count(var)) {
+      replaced.insert(var);
+      copy->ReplaceUse(var, vars[var]);
+    }
+  }
+  if (copy->GetDst() && vars.count(copy->GetDst()))
+    copy->ReplaceDst(vars[copy->GetDst()]);
+  Label *label = dynamic_cast<Label*>(copy);
+  if (label && labels.count(label->text()))
+    copy->ReplaceLabel(labels[label->text()]);
+  std::vector<const char*> targets;
+  FlowGraph::BranchTargets(copy, &targets);
+  for (unsigned i = 0; i < targets.size(); i++)
+    if (labels.count(targets[i]))
+      FlowGraph::Retarget(copy, targets[i], labels[targets[i]]);
+  return copy;
+}
+
+/* Method: InlineCalls
+ * -------------------
+ * Replaces LCalls to functions compiled here by a copy of the callee's
+ * body. A callee is inlined if it does not call itself and has at most
+ * MaxInlineSize instructions (not counting labels), as long as the
+ * caller has not already grown by MaxInlineGrowth. Only the calls in
+ * the caller as it was are considered, so inlining goes one level deep.
+ * -d inline reports each decision.
+ */
+bool Optimizer::InlineCalls(Iterator begin, Iterator end)
+{
+  const char *caller = FunctionName(begin);
+  int growth = 0;
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    LCall *call = dynamic_cast<LCall*>(*p);
+    if (!call || !functions.count(call->GetLabel())) continue;
+    const char *callee = call->GetLabel();
+    Iterator body = functions[callee], bodyEnd = FunctionEnd(body);
+    ++body;    // skip the BeginFunc
+    --bodyEnd; // and the EndFunc
+    int size = 0;
+    bool recursive = false;
+    for (Iterator q = body; q != bodyEnd; ++q) {
+      LCall *inner = dynamic_cast<LCall*>(*q);
+      if (inner && strcmp(inner->GetLabel(), callee) == 0) recursive = true;
+      if (!dynamic_cast<Label*>(*q)) size++;
+    }
+    if (recursive) {
+      PrintDebug("inline", "%s: not inlining %s, it is recursive", caller, callee);
+    } else if (size > MaxInlineSize) {
+      PrintDebug("inline", "%s: not inlining %s, size %d is over %d", caller,
+                 callee, size, MaxInlineSize);
+    } else if (growth + size > MaxInlineGrowth) {
+      PrintDebug("inline", "%s: not inlining %s, caller has grown by %d", caller,
+                 callee, growth);
+    } else {
+      PrintDebug("inline", "%s: inlining %s, size %d", caller, callee, size);
+      growth += size;
+      Iterator endFunc = end;
+      p = InlineCall(p, body, bodyEnd, dynamic_cast<BeginFunc*>(*begin), --endFunc);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Returns the start of the error stubs ending [begin, end), the code
+// after the last Return that ends in a call to _Halt, or end if none.
+static Optimizer::Iterator ErrorStubs(Optimizer::Iterator begin, Optimizer::Iterator end)
+{
+  Optimizer::Iterator q = end;
+  LCall *halt = (q != begin) ? dynamic_cast<LCall*>(*--q) : NULL;
+  if (!halt || strcmp(halt->GetLabel(), "_Halt") != 0)
+    return end;
+  while (q != begin && !dynamic_cast<Return*>(*q) && !FlowGraph::BranchTarget(*q)) --q;
+  return dynamic_cast<Return*>(*q) ? ++q : end;
+}
+
+// Maps the message of each error stub in [begin, end) to its label.
+static void StubMessages(Optimizer::Iterator begin, Optimizer::Iterator end,
+                         std::map<std::string, const char*> *messages)
+{
+  const char *label = NULL;
+  for (Optimizer::Iterator q = begin; q != end; ++q) {
+    LoadStringConstant *load = dynamic_cast<LoadStringConstant*>(*q);
+    if (Label *l = dynamic_cast<Label*>(*q))
+      label = l->text();
+    else if (load && label && !messages->count(load->GetString()))
+      (*messages)[load->GetString()] = label;
+  }
+}
+
+/* Method: InlineCall
+ * ------------------
+ * Splices a copy of [body, bodyEnd) in place of the call, its pushes and
+ * its PopParams. Each variable of the callee becomes a new local of the
+ * caller (frame is grown to hold them) and each parameter is first
+ * assigned its argument. Labels are renamed and a Return assigns the
+ * call's result and jumps to the end of the copy. The callee's error
+ * stubs (see ErrorStubs) are not copied in place: a check branching to
+ * one goes to the caller's stub for the same message instead, and only
+ * the stubs the caller lacks are copied to its own, in front of its
+ * EndFunc (endFunc), so there stays one stub per message. Returns the
+ * position of the last instruction inserted in place of the call.
+ */
+Optimizer::Iterator Optimizer::InlineCall(Iterator call, Iterator body, Iterator bodyEnd,
+                                          BeginFunc *frame, Iterator endFunc)
+{
+  static int numInlined = 0;
+  numInlined++;
+  Location *result = (*call)->GetDst();
+  std::vector<Location*> args; // args[0] is pushed last
+  Iterator first = call;
+  while (dynamic_cast<PushParam*>(*--first))
+    args.push_back(dynamic_cast<PushParam*>(*first)->GetParam());
+  ++first;
+
+  std::map<Location*, Location*> vars;
+  std::map<std::string, const char*> labels;
+  for (Iterator q = body; q != bodyEnd; ++q) {
+    if (Label *label = dynamic_cast<Label*>(*q))
+      labels[label->text()] = CodeGenerator::NewLabel();
+    List<Location*> used;
+    (*q)->GetUses(&used);
+    if ((*q)->GetDst()) used.Append((*q)->GetDst());
+    for (int i = 0; i < used.NumElements(); i++) {
+      Location *var = used.Nth(i);
+      if (var->GetSegment() != fpRelative || vars.count(var)) continue;
+      char name[128];
+      snprintf(name, sizeof(name), "%s.%d", var->GetName(), numInlined);
+      vars[var] = NewLocal(frame, name);
+      if (var->GetOffset() > 0) {
+        unsigned param = (var->GetOffset() - CodeGenerator::OffsetToFirstParam)
+          / CodeGenerator::VarSize;
+        Assert(param < args.size());
+        code.insert(first, new Assign(vars[var], args[param]));
+      }
+    }
+  }
+
+  Iterator stubs = ErrorStubs(body, bodyEnd), callerStubs = ErrorStubs(call, endFunc);
+  bool callerHasStubs = (callerStubs != endFunc);
+  std::map<std::string, const char*> messages;
+  StubMessages(callerStubs, endFunc, &messages);
+  std::set<std::string> shared; // the callee's stubs the caller has
+  const char *stub = NULL;
+  for (Iterator q = stubs; q != bodyEnd; ++q) {
+    LoadStringConstant *load = dynamic_cast<LoadStringConstant*>(*q);
+    if (Label *label = dynamic_cast<Label*>(*q))
+      stub = label->text();
+    else if (load && stub && messages.count(load->GetString())) {
+      labels[stub] = messages[load->GetString()];
+      shared.insert(stub);
+    }
+  }
+  bool copying = false;
+  for (Iterator q = stubs; q != bodyEnd; ++q) {
+    if (Label *label = dynamic_cast<Label*>(*q))
+      copying = !shared.count(label->text());
+    if (!copying) continue;
+    if (!callerHasStubs) code.insert(endFunc, new Return(NULL));
+    callerHasStubs = true;
+    code.insert(endFunc, CopyInstruction(*q, vars, labels));
+  }
+
+  const char *exit = NULL;
+  for (Iterator q = body; q != stubs; ++q) {
+    Return *ret = dynamic_cast<Return*>(*q);
+    if (!ret) {
+      code.insert(first, CopyInstruction(*q, vars, labels));
+      continue;
+    }
+    Location *value = ret->GetValue();
+    if (result && value)
+      code.insert(first, new Assign(result, vars.count(value) ? vars[value] : value));
+    Iterator next = q;
+    if (++next != stubs) {
+      if (!exit) exit = CodeGenerator::NewLabel();
+      code.insert(first, new Goto(exit));
+    }
+  }
+  if (exit) code.insert(first, new Label(exit));
+
+  Iterator after = call;
+  if (++after != code.end() && dynamic_cast<PopParams*>(*after))
+    ++after;
+  code.erase(first, after);
+  return --after;
+}
+
+
+// True if the instructions after the call at p, following Gotos, do
+// nothing but copy its result before returning it (or returning nothing
+// or falling off the end, for a void function).
+static bool ReachesReturn(Optimizer::Iterator p, Location *result,
+                          std::map<std::string, Optimizer::Iterator> &labels)
+{
+  for (int steps = 0; steps < 32; steps++) {
+    Instruction *instr = *++p;
+    Return *ret = dynamic_cast<Return*>(instr);
+    Assign *copy = dynamic_cast<Assign*>(instr);
+    Goto *jump = dynamic_cast<Goto*>(instr);
+    if (ret)
+      return !ret->GetValue() || ret->GetValue() == result;
+    if (dynamic_cast<EndFunc*>(instr))
+      return true;
+    if (copy && result && copy->GetSrc() == result
+        && copy->GetDst()->GetSegment() == fpRelative)
+      result = copy->GetDst();
+    else if (jump)
+      p = labels[jump->branch_label()];
+    else if (!dynamic_cast<PopParams*>(instr) && !dynamic_cast<Label*>(instr))
+      return false;
+  }
+  return false;
+}
+
+/* Method: EliminateTailCalls
+ * ---------------------------
+ * A call is in tail position when all that follows it (see
+ * ReachesReturn) is returning its result. A tail call of the function
+ * to itself becomes a loop: the arguments are copied (through fresh
+ * temps, as they may read the parameters) into the parameters and
+ * control jumps back to the top.
+ * Any other tail call to a function compiled here or through a vtable
+ * is marked as a tail call, so that the Mips code pops our frame before
+ * jumping to the callee. That is only done when all of its arguments
+ * go in $a0-$a3 and fit in the space our caller made for our own
+ * parameters, as the callee may store them there.
+ */
+bool Optimizer::EliminateTailCalls(Iterator begin, Iterator end)
+{
+  BeginFunc *frame = dynamic_cast<BeginFunc*>(*begin);
+  const char *name = FunctionName(begin);
+  std::map<int, Location*> params;
+  for (Iterator p = begin; p != end; ++p) {
+    List<Location*> used;
+    (*p)->GetUses(&used);
+    if ((*p)->GetDst()) used.Append((*p)->GetDst());
+    for (int i = 0; i < used.NumElements(); i++)
+      if (used.Nth(i)->GetSegment() == fpRelative && used.Nth(i)->GetOffset() > 0)
+        params[used.Nth(i)->GetOffset()] = used.Nth(i);
+  }
+
+  std::map<std::string, Iterator> labels;
+  for (Iterator p = begin; p != end; ++p)
+    if (Label *label = dynamic_cast<Label*>(*p))
+      labels[label->text()] = p;
+
+  const char *top = NULL;
+  bool changed = false;
+  for (Iterator p = begin; p != end; ++p) {
+    LCall *lcall = dynamic_cast<LCall*>(*p);
+    ACall *acall = dynamic_cast<ACall*>(*p);
+    if ((!lcall || lcall->IsTail()) && (!acall || acall->IsTail())) continue;
+    if (!ReachesReturn(p, (*p)->GetDst(), labels)) continue;
+    Iterator next = p; // [p, next) is the call and its PopParams
+    if (dynamic_cast<PopParams*>(*++next)) ++next;
+
+    std::vector<Location*> args; // args[0] is pushed last
+    Iterator first = p;
+    while (dynamic_cast<PushParam*>(*--first))
+      args.push_back(dynamic_cast<PushParam*>(*first)->GetParam());
+    ++first;
+
+    if (lcall && strcmp(lcall->GetLabel(), name) == 0) {
+      PrintDebug("tailcall", "%s: recursive tail call made a loop", name);
+      if (!top) {
+        top = CodeGenerator::NewLabel();
+        Iterator entry = begin;
+        code.insert(++entry, new Label(top));
+      }
+      std::vector<Location*> temps(args.size());
+      for (unsigned i = 0; i < args.size(); i++) {
+        temps[i] = NewLocal(frame, "_arg");
+        code.insert(first, new Assign(temps[i], args[i]));
+      }
+      for (unsigned i = 0; i < args.size(); i++) {
+        int offset = CodeGenerator::OffsetToFirstParam + i*CodeGenerator::VarSize;
+        if (params.count(offset))
+          code.insert(first, new Assign(params[offset], temps[i]));
+      }
+      code.insert(first, new Goto(top));
+    } else if ((acall || functions.count(lcall->GetLabel()))
+               && (int)args.size() <= Mips::NumArgRegs
+               && (int)args.size() <= frame->GetNumParams()) {
+      PrintDebug("tailcall", "%s: tail call to %s", name,
+                 lcall ? lcall->GetLabel() : acall->GetMethodAddr()->GetName());
+      Instruction *call = lcall ? (Instruction*)new LCall(lcall->GetLabel(), NULL, true)
+                                : (Instruction*)new ACall(acall->GetMethodAddr(), NULL, true);
+      code.insert(p, call);
+      first = p; // keep the pushes
+    } else {
+      continue;
+    }
+    code.erase(first, next);
+    p = --next;
+    changed = true;
+  }
+  return changed;
+}
+
+
+// True if the branch ending b jumps to the stub reporting an array
+// subscript out of bounds, i.e. is one of the two tests of a bounds
+// check.
+static bool IsBoundsCheck(BasicBlock *b)
+{
+  const char *target = FlowGraph::BranchTarget(b->Last());
+  for (unsigned i = 0; i < b->succs.size(); i++) {
+    Optimizer::Iterator p = b->succs[i]->begin;
+    Label *label = dynamic_cast<Label*>(*p);
+    if (!label || strcmp(label->text(), target) != 0) continue;
+    LoadStringConstant *error = dynamic_cast<LoadStringConstant*>(*++p);
+    return error && strncmp(error->GetString() + 1, err_arr_out_of_bounds,
+                            strlen(err_arr_out_of_bounds)) == 0;
+  }
+  return false;
+}
+
+/* Method: RemoveBoundsChecks
+ * --------------------------
+ * The facts known on entry to each block are those holding on all the
+ * edges into it, found by iterating over the flow graph until nothing
+ * changes. A block whose facts keep changing (a loop header whose
+ * variables keep growing) is widened after MaxChanges so the iteration
+ * ends. Each edge out of a conditional branch adds what the comparison
+ * showed. Then each IfZ or IfCmp whose test is decided becomes a Goto
+ * or is deleted, leaving the code it skipped for RemoveDeadCode.
+ */
+bool Optimizer::RemoveBoundsChecks(Iterator begin, Iterator end)
+{
+  const int MaxChanges = 3;
+  FlowGraph graph(begin, end);
+  graph.ComputeLiveness();
+  int n = graph.blocks.size();
+  std::vector<RangeFacts> in(n), taken(n), fallen(n);
+  std::vector<int> changes(n, 0);
+  in[0].reached = true;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < n; i++) {
+      BasicBlock *b = graph.blocks[i];
+      if (!b->reachable) continue;
+      if (i > 0) {
+        Label *label = dynamic_cast<Label*>(*b->begin);
+        RangeFacts facts;
+        for (unsigned j = 0; j < b->preds.size(); j++) {
+          BasicBlock *pred = b->preds[j];
+          std::vector<const char*> targets;
+          FlowGraph::BranchTargets(pred->Last(), &targets);
+          bool jumps = false;
+          for (unsigned k = 0; k < targets.size() && label; k++)
+            jumps |= strcmp(targets[k], label->text()) == 0;
+          bool falls = pred->id + 1 == i && !FlowGraph::EndsFlow(pred->Last());
+          if (jumps) facts.Meet(taken[pred->id]);
+          if (falls) facts.Meet(fallen[pred->id]);
+        }
+        if (changes[i] >= MaxChanges) facts.Widen(in[i]);
+        if (facts == in[i]) continue;
+        in[i] = facts;
+        changes[i]++;
+        changed = true;
+      }
+      RangeFacts out = in[i];
+      for (Iterator p = b->begin; p != b->end; ++p)
+        out.Apply(*p);
+      taken[i] = fallen[i] = out;
+      if (IfCmp *cmp = dynamic_cast<IfCmp*>(b->Last())) {
+        taken[i].Assume(cmp->GetRelation(), cmp->GetOp1(), cmp->GetOp2());
+        fallen[i].Assume(IfCmp::Negate(cmp->GetRelation()), cmp->GetOp1(), cmp->GetOp2());
+      }
+      taken[i].Prune(b->liveOut);
+      fallen[i].Prune(b->liveOut);
+    }
+  }
+
+  int removed = 0, kept = 0;
+  bool folded = false;
+  std::vector<Iterator> dead;
+  for (int i = 0; i < n; i++) {
+    BasicBlock *b = graph.blocks[i];
+    if (!b->reachable) continue;
+    RangeFacts facts = in[i];
+    for (Iterator p = b->begin; p != b->end; ++p)
+      facts.Apply(*p);
+    Iterator last = b->end;
+    --last;
+    IfZ *ifz = dynamic_cast<IfZ*>(*last);
+    IfCmp *cmp = dynamic_cast<IfCmp*>(*last);
+    bool decided = false, jumps;
+    int value;
+    if (ifz && facts.ValueOf(ifz->GetTest(), &value)) {
+      decided = true;
+      jumps = (value == 0);
+    }
+    if (cmp)
+      decided = facts.Decides(cmp->GetRelation(), cmp->GetOp1(), cmp->GetOp2(), &jumps);
+    if ((ifz || cmp) && IsBoundsCheck(b))
+      (decided && !jumps) ? removed++ : kept++;
+    if (!decided) continue;
+    if (jumps) *last = new Goto(FlowGraph::BranchTarget(*last));
+    else dead.push_back(last);
+    folded = true;
+  }
+  for (unsigned i = 0; i < dead.size(); i++)
+    code.erase(dead[i]);
+  if (removed + kept > 0)
+    PrintDebug("bounds", "%s: %d bounds tests removed, %d kept", FunctionName(begin),
+               removed, kept);
+  return folded;
+}
+
+/* Method: HoistInvariants
+ * ------------------------
+ * Works on one loop at a time, innermost first, building a new flow
+ * graph after each loop that changes until none does. Code moved out of
+ * an inner loop can then move on out of the loops around it.
+ */
+bool Optimizer::HoistInvariants(Iterator begin, Iterator end)
+{
+  const char *name = FunctionName(begin);
+  bool changed = false, hoisted;
+  do {
+    FlowGraph graph(begin, end);
+    graph.ComputeLiveness();
+    graph.FindLoops();
+    hoisted = false;
+    for (unsigned i = 0; i < graph.loops.size() && !hoisted; i++)
+      hoisted = HoistFromLoop(&graph, graph.loops[i], name);
+    changed |= hoisted;
+  } while (hoisted);
+  return changed;
+}
+
+/* Method: HoistFromLoop
+ * ---------------------
+ * An instruction is invariant if every variable it reads is in the
+ * frame and is either not written in the loop or only written by an
+ * invariant instruction. It is moved if it is side-effect free, is the
+ * only write to its destination in the loop and that destination is
+ * live neither on entry to the header nor on an edge leaving the loop,
+ * so no read can tell when it ran. A Load might trap, so it only moves
+ * if it runs whenever the loop is entered (its block dominates every
+ * block the loop can be left from) and nothing in the loop stores to
+ * memory or calls a function compiled here. The builtins do not write
+ * to memory the program can see.
+ */
+bool Optimizer::HoistFromLoop(FlowGraph *graph, Loop *loop, const char *name)
+{
+  Label *header = dynamic_cast<Label*>(*loop->header->begin);
+  if (!header) return false;
+
+  std::map<int, int> writes;      // number of writes to each frame variable
+  std::vector<BasicBlock*> exits; // blocks with a successor outside the loop
+  std::set<int> liveOnExit = loop->header->liveIn;
+  bool writesMemory = false;
+  for (unsigned i = 0; i < graph->blocks.size(); i++) {
+    BasicBlock *b = graph->blocks[i];
+    if (!loop->Contains(b)) continue;
+    for (Iterator p = b->begin; p != b->end; ++p) {
+      Location *dst = (*p)->GetDst();
+      if (dst && dst->GetSegment() == fpRelative) writes[dst->GetOffset()]++;
+      LCall *lcall = dynamic_cast<LCall*>(*p);
+      if (dynamic_cast<Store*>(*p) || dynamic_cast<ACall*>(*p)
+          || (lcall && functions.count(lcall->GetLabel())))
+        writesMemory = true;
+    }
+    for (unsigned j = 0; j < b->succs.size(); j++)
+      if (!loop->Contains(b->succs[j])) {
+        if (exits.empty() || exits.back() != b) exits.push_back(b);
+        liveOnExit.insert(b->succs[j]->liveIn.begin(), b->succs[j]->liveIn.end());
+      }
+  }
+
+  std::vector<Iterator> moved;
+  std::set<int> invariant; // written in the loop only by a moved instruction
+  bool found;
+  do {
+    found = false;
+    for (unsigned i = 0; i < graph->blocks.size(); i++) {
+      BasicBlock *b = graph->blocks[i];
+      if (!loop->Contains(b)) continue;
+      for (Iterator p = b->begin; p != b->end; ++p) {
+        Location *dst = (*p)->GetDst();
+        if (!dst || !IsLocal(dst) || !HasNoSideEffects(*p)) continue;
+        int var = dst->GetOffset();
+        if (writes[var] != 1 || invariant.count(var) || liveOnExit.count(var))
+          continue;
+        List<Location*> uses;
+        (*p)->GetUses(&uses);
+        bool movable = true;
+        for (int j = 0; j < uses.NumElements() && movable; j++) {
+          Location *use = uses.Nth(j);
+          movable = use->GetSegment() == fpRelative
+              && (!writes.count(use->GetOffset()) || invariant.count(use->GetOffset()));
+        }
+        if (dynamic_cast<Load*>(*p)) {
+          movable &= !writesMemory;
+          for (unsigned j = 0; j < exits.size() && movable; j++)
+            movable = exits[j]->DominatedBy(b);
+        }
+        if (movable) {
+          invariant.insert(var);
+          moved.push_back(p);
+          found = true;
+        }
+      }
+    }
+  } while (found);
+  if (moved.empty()) return false;
+
+  Iterator preheader = Preheader(graph, loop);
+  for (unsigned i = 0; i < moved.size(); i++) {
+    Instruction *instr = *moved[i];
+    code.erase(moved[i]);
+    code.insert(preheader, instr);
+    PrintDebug("licm", "%s: hoisted out of the loop at %s:", name, header->text());
+    if (IsDebugOn("licm")) instr->Print();
+  }
+  return true;
+}
+
+/* Method: Preheader
+ * -----------------
+ * A block is reused if it is the only way into the loop and leads
+ * nowhere else. Otherwise a new label is put in front of the header and
+ * the branches into the loop from outside retargeted to it. A block of
+ * the loop that used to fall through into the header now jumps there.
+ */
+Optimizer::Iterator Optimizer::Preheader(FlowGraph *graph, Loop *loop)
+{
+  BasicBlock *header = loop->header;
+  std::vector<BasicBlock*> entries;
+  for (unsigned i = 0; i < header->preds.size(); i++)
+    if (header->preds[i]->reachable && !loop->Contains(header->preds[i]))
+      entries.push_back(header->preds[i]);
+  if (entries.size() == 1 && entries[0]->succs.size() == 1) {
+    Iterator last = entries[0]->end;
+    std::vector<const char*> targets;
+    FlowGraph::BranchTargets(*--last, &targets);
+    return targets.empty() ? entries[0]->end : last;
+  }
+
+  const char *name = dynamic_cast<Label*>(*header->begin)->text();
+  const char *label = CodeGenerator::NewLabel();
+  for (unsigned i = 0; i < entries.size(); i++)
+    FlowGraph::Retarget(entries[i]->Last(), name, label);
+  if (header->id > 0) {
+    BasicBlock *prev = graph->blocks[header->id - 1];
+    if (loop->Contains(prev) && !FlowGraph::EndsFlow(prev->Last()))
+      code.insert(header->begin, new Goto(name));
+  }
+  code.insert(header->begin, new Label(label));
+  return header->begin;
+}
+
+
+// How the value of a variable in a loop follows a basic induction
+// variable: scale * basic + base + offset, where base is a variable the
+// loop does not write, or NULL.
+struct Induction {
+  int basic, scale;
+  Location *base;
+  int offset;
+};
+
+// A basic induction variable is a local whose only write in a loop adds
+// a constant step to it, either directly or by a copy i = t of a temp
+// computed as t = i + step earlier in the same block (the chain).
+struct BasicInduction {
+  Location *var;
+  BasicBlock *block;
+  Optimizer::Iterator update, chain;
+  bool hasChain;
+  int step;
+};
+
+// Counts the writes to each frame variable in the loop and collects the
+// variables live on the edges leaving it.
+static void ScanLoop(FlowGraph *graph, Loop *loop, std::map<int, int> *writes,
+                     std::set<int> *liveOnExit)
+{
+  for (unsigned i = 0; i < graph->blocks.size(); i++) {
+    BasicBlock *b = graph->blocks[i];
+    if (!loop->Contains(b)) continue;
+    for (Optimizer::Iterator p = b->begin; p != b->end; ++p) {
+      Location *dst = (*p)->GetDst();
+      if (dst && dst->GetSegment() == fpRelative) (*writes)[dst->GetOffset()]++;
+    }
+    for (unsigned j = 0; j < b->succs.size(); j++)
+      if (!loop->Contains(b->succs[j]))
+        liveOnExit->insert(b->succs[j]->liveIn.begin(), b->succs[j]->liveIn.end());
+  }
+}
+
+// True if instr computes var plus or minus a constant (the step).
+static bool IsIncrement(Instruction *instr, Location *var,
+                        std::map<int, int> &onlyValue, int *step)
+{
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  if (!op) return false;
+  Location *a = op->GetOp1(), *b = op->GetOp2();
+  std::map<int, int> none;
+  int c;
+  if (op->GetOpCode() == BinaryOp::Add) {
+    if (KeyFor(b) == KeyFor(var)) std::swap(a, b);
+    if (KeyFor(a) != KeyFor(var) || !ValueOf(b, none, onlyValue, &c)) return false;
+    *step = c;
+    return true;
+  }
+  if (op->GetOpCode() == BinaryOp::Sub) {
+    if (KeyFor(a) != KeyFor(var) || !ValueOf(b, none, onlyValue, &c)) return false;
+    *step = (int)(0u - c);
+    return true;
+  }
+  return false;
+}
+
+static void FindBasicInductions(FlowGraph *graph, Loop *loop, std::map<int, int> &writes,
+                                std::map<int, int> &onlyValue,
+                                std::map<int, BasicInduction> *basics)
+{
+  for (unsigned i = 0; i < graph->blocks.size(); i++) {
+    BasicBlock *b = graph->blocks[i];
+    if (!loop->Contains(b)) continue;
+    for (Optimizer::Iterator p = b->begin; p != b->end; ++p) {
+      Location *dst = (*p)->GetDst();
+      if (!dst || !IsLocal(dst) || writes[dst->GetOffset()] != 1) continue;
+      BasicInduction iv;
+      iv.var = dst;
+      iv.block = b;
+      iv.update = p;
+      iv.hasChain = false;
+      Assign *assign = dynamic_cast<Assign*>(*p);
+      if (assign) {
+        Location *temp = assign->GetSrc();
+        if (!IsLocal(temp) || writes[temp->GetOffset()] != 1) continue;
+        for (Optimizer::Iterator q = p; q != b->begin && !iv.hasChain; ) {
+          Location *def = (*--q)->GetDst();
+          if (!def || KeyFor(def) != KeyFor(temp)) continue;
+          if (!IsIncrement(*q, dst, onlyValue, &iv.step)) break;
+          iv.chain = q;
+          iv.hasChain = true;
+        }
+        if (!iv.hasChain) continue;
+      } else if (!IsIncrement(*p, dst, onlyValue, &iv.step)) {
+        continue;
+      }
+      if (iv.step != 0) (*basics)[dst->GetOffset()] = iv;
+    }
+  }
+}
+
+// Works out how the value instr computes follows an induction variable,
+// from what is known about the variables it reads (known), if it does.
+static bool DerivedInduction(Instruction *instr, std::map<int, Induction> &known,
+                             std::map<int, int> &writes, std::map<int, int> &onlyValue,
+                             Induction *result)
+{
+  if (Assign *assign = dynamic_cast<Assign*>(instr)) {
+    Location *src = assign->GetSrc();
+    if (src->GetSegment() != fpRelative || !known.count(src->GetOffset())) return false;
+    *result = known[src->GetOffset()];
+    return true;
+  }
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  if (!op) return false;
+  BinaryOp::OpCode code = op->GetOpCode();
+  Location *a = op->GetOp1(), *b = op->GetOp2();
+  if (a->GetSegment() != fpRelative || !known.count(a->GetOffset())) {
+    if (code == BinaryOp::Sub) return false;
+    std::swap(a, b);
+    if (a->GetSegment() != fpRelative || !known.count(a->GetOffset())) return false;
+  }
+  Induction iv = known[a->GetOffset()];
+  std::map<int, int> none;
+  int c;
+  bool isConstant = ValueOf(b, none, onlyValue, &c);
+  bool isInvariant = b->GetSegment() == fpRelative && !writes.count(b->GetOffset());
+  switch (code) {
+    case BinaryOp::Add:
+      if (isConstant) iv.offset = (int)((unsigned)iv.offset + c);
+      else if (isInvariant && !iv.base) iv.base = b;
+      else return false;
+      break;
+    case BinaryOp::Sub:
+      if (!isConstant) return false;
+      iv.offset = (int)((unsigned)iv.offset - c);
+      break;
+    case BinaryOp::Mul:
+      if (!isConstant || iv.base) return false;
+      iv.scale = (int)((unsigned)iv.scale * c);
+      iv.offset = (int)((unsigned)iv.offset * c);
+      break;
+    default:
+      return false;
+  }
+  *result = iv;
+  return true;
+}
+
+// Only a multiply that is more than a shift, or a scaled index added to
+// a base, costs more than the add that replaces it.
+static bool WorthReducing(const Induction &iv)
+{
+  unsigned scale = iv.scale < 0 ? 0u - iv.scale : iv.scale;
+  return scale > 1 && (iv.base || (scale & (scale - 1)) != 0);
+}
+
+/* Method: ReduceInductionVariables
+ * --------------------------------
+ * Like HoistInvariants, takes one loop at a time, innermost first, with
+ * a new flow graph after each change. Dead code is removed in between
+ * so that the induction variables only kept alive by the expressions
+ * that were rewritten disappear before the loop tests are looked at.
+ */
+bool Optimizer::ReduceInductionVariables(Iterator begin, Iterator end)
+{
+  const char *name = FunctionName(begin);
+  bool changed = false, reduced;
+  do {
+    FlowGraph graph(begin, end);
+    graph.ComputeLiveness();
+    graph.FindLoops();
+    reduced = false;
+    for (unsigned i = 0; i < graph.loops.size() && !reduced; i++)
+      reduced = ReduceInLoop(&graph, graph.loops[i], name)
+             || ReplaceLoopTest(&graph, graph.loops[i], name);
+    if (reduced)
+      while (RemoveDeadCode(begin, end)) ;
+    changed |= reduced;
+  } while (reduced);
+  return changed;
+}
+
+/* Method: ReduceInLoop
+ * --------------------
+ * Within each block of the loop, follows the values computed from its
+ * basic induction variables: i + c, i * c, base + i * c and so on. A
+ * block starts from what was known at the end of its predecessor if it
+ * has only one (that came earlier), else from the basic variables
+ * themselves. What was computed from one is forgotten once it is
+ * updated. An expression worth reducing whose result is used by
+ * something other than another such expression is replaced by a read
+ * of a new variable holding scale * i + base, which is computed in the
+ * preheader and advanced by step * scale right after each update of i.
+ * Expressions that differ only in their constant offset share the new
+ * variable; the offset is added back and usually ends up in a Load or
+ * Store.
+ */
+bool Optimizer::ReduceInLoop(FlowGraph *graph, Loop *loop, const char *name)
+{
+  Label *header = dynamic_cast<Label*>(*loop->header->begin);
+  if (!header) return false;
+  std::map<int, int> writes, onlyValue;
+  std::set<int> used;
+  std::map<int, BasicInduction> basics;
+  ScanLoop(graph, loop, &writes, &used);
+  FindConstantLocals(graph->blocks.front()->begin, graph->blocks.back()->end, &onlyValue);
+  FindBasicInductions(graph, loop, writes, onlyValue, &basics);
+  if (basics.empty()) return false;
+
+  std::vector<std::pair<Iterator, Induction> > found;
+  std::set<Instruction*> isFound;
+  std::map<BasicBlock*, std::map<int, Induction> > atEnd;
+  for (unsigned i = 0; i < graph->blocks.size(); i++) {
+    BasicBlock *b = graph->blocks[i];
+    if (!loop->Contains(b)) continue;
+    std::map<int, Induction> &known = atEnd[b];
+    if (b != loop->header && b->preds.size() == 1 && atEnd.count(b->preds[0])) {
+      known = atEnd[b->preds[0]];
+    } else {
+      for (std::map<int, BasicInduction>::iterator j = basics.begin(); j != basics.end(); ++j) {
+        Induction iv = { j->first, 1, NULL, 0 };
+        known[j->first] = iv;
+      }
+    }
+    for (Iterator p = b->begin; p != b->end; ++p) {
+      Location *dst = (*p)->GetDst();
+      if (!dst || dst->GetSegment() != fpRelative) continue;
+      int var = dst->GetOffset();
+      if (basics.count(var) && basics[var].update == p) {
+        std::map<int, Induction>::iterator j = known.begin();
+        while (j != known.end()) {
+          if (j->second.basic == var && j->first != var) known.erase(j++);
+          else ++j;
+        }
+        continue;
+      }
+      Induction iv;
+      bool derived = IsLocal(dst) && DerivedInduction(*p, known, writes, onlyValue, &iv);
+      known.erase(var);
+      if (!derived) continue;
+      known[var] = iv;
+      if (dynamic_cast<BinaryOp*>(*p) && WorthReducing(iv)) {
+        found.push_back(std::make_pair(p, iv));
+        isFound.insert(*p);
+      }
+    }
+  }
+  for (unsigned i = 0; i < graph->blocks.size(); i++) {
+    BasicBlock *b = graph->blocks[i];
+    if (!loop->Contains(b)) continue;
+    for (Iterator p = b->begin; p != b->end; ++p) {
+      if (isFound.count(*p)) continue;
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int j = 0; j < uses.NumElements(); j++)
+        if (uses.Nth(j)->GetSegment() == fpRelative) used.insert(uses.Nth(j)->GetOffset());
+    }
+  }
+
+  BeginFunc *frame = dynamic_cast<BeginFunc*>(*graph->blocks.front()->begin);
+  typedef std::pair<std::pair<int, int>, VarKey> Family; // basic, scale, base
+  std::map<Family, Location*> pointers;
+  Iterator preheader;
+  int reduced = 0;
+  for (unsigned i = 0; i < found.size(); i++) {
+    Iterator p = found[i].first;
+    Induction &iv = found[i].second;
+    Location *dst = (*p)->GetDst();
+    if (!used.count(dst->GetOffset())) continue;
+    if (reduced++ == 0) preheader = Preheader(graph, loop);
+    BasicInduction &basic = basics[iv.basic];
+    Family family(std::make_pair(iv.basic, iv.scale),
+                  iv.base ? KeyFor(iv.base) : VarKey(-1, 0));
+    if (!pointers.count(family)) {
+      char temp[128];
+      snprintf(temp, sizeof(temp), "%s.iv%d", basic.var->GetName(), (int)pointers.size());
+      Location *ptr = NewLocal(frame, temp);
+      snprintf(temp, sizeof(temp), "%s.scale", ptr->GetName());
+      Location *scale = NewLocal(frame, temp);
+      snprintf(temp, sizeof(temp), "%s.step", ptr->GetName());
+      Location *stride = NewLocal(frame, temp);
+      code.insert(preheader, new LoadConstant(scale, iv.scale));
+      code.insert(preheader, new BinaryOp(BinaryOp::Mul, ptr, basic.var, scale));
+      if (iv.base) code.insert(preheader, new BinaryOp(BinaryOp::Add, ptr, iv.base, ptr));
+      code.insert(preheader, new LoadConstant(stride, (int)((unsigned)basic.step * iv.scale)));
+      Iterator after = basic.update;
+      code.insert(++after, new BinaryOp(BinaryOp::Add, ptr, ptr, stride));
+      pointers[family] = ptr;
+    }
+    Location *ptr = pointers[family];
+    if (iv.offset == 0) {
+      *p = new Assign(dst, ptr);
+    } else {
+      char temp[128];
+      snprintf(temp, sizeof(temp), "%s.offset", ptr->GetName());
+      Location *offset = NewLocal(frame, temp);
+      code.insert(preheader, new LoadConstant(offset, iv.offset));
+      *p = new BinaryOp(BinaryOp::Add, dst, ptr, offset);
+    }
+  }
+  if (reduced > 0)
+    PrintDebug("iv", "%s: %d induction expressions in the loop at %s reduced to %d adds",
+               name, reduced, header->text(), (int)pointers.size());
+  return reduced > 0;
+}
+
+// Returns the LoadConstant giving var its value on entry to the loop, if
+// there is one way in and var is last set by a LoadConstant there.
+static LoadConstant *InitialValue(Loop *loop, Location *var)
+{
+  BasicBlock *h = loop->header, *entry = NULL;
+  for (unsigned i = 0; i < h->preds.size(); i++)
+    if (h->preds[i]->reachable && !loop->Contains(h->preds[i])) {
+      if (entry) return NULL;
+      entry = h->preds[i];
+    }
+  if (!entry) return NULL;
+  for (Optimizer::Iterator p = entry->end; p != entry->begin; ) {
+    Location *dst = (*--p)->GetDst();
+    if (dst && KeyFor(dst) == KeyFor(var)) return dynamic_cast<LoadConstant*>(*p);
+  }
+  return NULL;
+}
+
+// True if the only write to var loads the word a pointer points at with
+// no offset, i.e. the length of an array (an object's vtable is never
+// compared).
+static bool IsArrayLength(FlowGraph *graph, Location *var)
+{
+  Load *length = NULL;
+  int defs = 0;
+  for (unsigned i = 0; i < graph->blocks.size(); i++)
+    for (Optimizer::Iterator p = graph->blocks[i]->begin; p != graph->blocks[i]->end; ++p) {
+      Location *dst = (*p)->GetDst();
+      if (dst && KeyFor(dst) == KeyFor(var) && defs++ == 0) length = dynamic_cast<Load*>(*p);
+    }
+  return defs == 1 && length && length->GetOffset() == 0;
+}
+
+/* Method: ReplaceLoopTest
+ * -----------------------
+ * Linear function test replacement. A loop whose header tests i < n
+ * (n not written in the loop), where i starts at i0 <= n, steps by 1 at
+ * most once per iteration and is read by nothing else, stops exactly
+ * when i reaches n. If another basic induction variable p is updated in
+ * the same block, p - scale * i stays the same, so the test can be made
+ * p == p0 + (n - i0) * scale with the right side computed once in the
+ * preheader, and i is deleted. Testing for equality is still right when
+ * the sides wrap around, as long as (n - i0) * scale does not, which is
+ * checked for a constant n and holds for an array length (the array
+ * takes VarSize bytes per element) when i0 is 0.
+ */
+bool Optimizer::ReplaceLoopTest(FlowGraph *graph, Loop *loop, const char *name)
+{
+  BasicBlock *h = loop->header;
+  Label *header = dynamic_cast<Label*>(*h->begin);
+  IfCmp *test = dynamic_cast<IfCmp*>(h->Last());
+  if (!header || !test || h->succs.size() != 2) return false;
+  BasicBlock *taken = NULL;
+  for (unsigned i = 0; i < h->succs.size(); i++) {
+    Label *label = dynamic_cast<Label*>(*h->succs[i]->begin);
+    if (label && strcmp(label->text(), test->branch_label()) == 0) taken = h->succs[i];
+  }
+  if (!taken || loop->Contains(h->succs[0]) == loop->Contains(h->succs[1])) return false;
+  bool exitsOnTrue = !loop->Contains(taken);
+  if (test->GetRelation() != (exitsOnTrue ? IfCmp::Ge : IfCmp::Lt)) return false;
+
+  std::map<int, int> writes, onlyValue;
+  std::set<int> liveOnExit;
+  std::map<int, BasicInduction> basics;
+  ScanLoop(graph, loop, &writes, &liveOnExit);
+  FindConstantLocals(graph->blocks.front()->begin, graph->blocks.back()->end, &onlyValue);
+  FindBasicInductions(graph, loop, writes, onlyValue, &basics);
+  Location *i = test->GetOp1(), *n = test->GetOp2();
+  if (!IsLocal(i) || !basics.count(i->GetOffset())) return false;
+  BasicInduction &iv = basics[i->GetOffset()];
+  if (iv.step != 1 || iv.block == h || liveOnExit.count(i->GetOffset())) return false;
+  if (n->GetSegment() != fpRelative || writes.count(n->GetOffset())) return false;
+  Location *temp = iv.hasChain ? (*iv.chain)->GetDst() : NULL;
+  if (temp && liveOnExit.count(temp->GetOffset())) return false;
+  for (unsigned j = 0; j < graph->loops.size(); j++) {
+    Loop *inner = graph->loops[j];
+    if (inner != loop && loop->Contains(inner->header) && inner->Contains(iv.block))
+      return false;
+  }
+  BasicInduction *other = NULL;
+  for (std::map<int, BasicInduction>::iterator j = basics.begin(); j != basics.end(); ++j)
+    if (j->first != i->GetOffset() && j->second.block == iv.block && !other)
+      other = &j->second;
+  if (!other) return false;
+  for (unsigned j = 0; j < graph->blocks.size(); j++) {
+    BasicBlock *b = graph->blocks[j];
+    if (!loop->Contains(b)) continue;
+    for (Iterator p = b->begin; p != b->end; ++p) {
+      if (p == iv.update || (iv.hasChain && p == iv.chain) || *p == test) continue;
+      List<Location*> uses;
+      (*p)->GetUses(&uses);
+      for (int k = 0; k < uses.NumElements(); k++)
+        if (KeyFor(uses.Nth(k)) == KeyFor(i) || (temp && KeyFor(uses.Nth(k)) == KeyFor(temp)))
+          return false;
+    }
+  }
+
+  LoadConstant *init = InitialValue(loop, i);
+  if (!init) return false;
+  long long first = init->GetValue(), span;
+  std::map<int, int> none;
+  int bound;
+  if (ValueOf(n, none, onlyValue, &bound)) {
+    span = bound - first;
+  } else {
+    if (!IsArrayLength(graph, n) || first != 0) return false;
+    span = (1LL << 32) / CodeGenerator::VarSize - 1;
+  }
+  long long scale = other->step;
+  if (span < 0 || span * (scale < 0 ? -scale : scale) >= (1LL << 32)) return false;
+
+  Iterator last = h->end;
+  --last;
+  Iterator preheader = Preheader(graph, loop);
+  BeginFunc *frame = dynamic_cast<BeginFunc*>(*graph->blocks.front()->begin);
+  char varName[128];
+  snprintf(varName, sizeof(varName), "%s.count", other->var->GetName());
+  Location *count = NewLocal(frame, varName);
+  snprintf(varName, sizeof(varName), "%s.scale", other->var->GetName());
+  Location *step = NewLocal(frame, varName);
+  snprintf(varName, sizeof(varName), "%s.end", other->var->GetName());
+  Location *limit = NewLocal(frame, varName);
+  code.insert(preheader, new BinaryOp(BinaryOp::Sub, count, n, i));
+  code.insert(preheader, new LoadConstant(step, other->step));
+  code.insert(preheader, new BinaryOp(BinaryOp::Mul, count, count, step));
+  code.insert(preheader, new BinaryOp(BinaryOp::Add, limit, other->var, count));
+  *last = new IfCmp(exitsOnTrue ? IfCmp::Eq : IfCmp::Ne, other->var, limit,
+                    test->branch_label());
+  if (iv.hasChain) code.erase(iv.chain);
+  code.erase(iv.update);
+  PrintDebug("iv", "%s: loop at %s tests %s instead of %s", name, header->text(),
+             other->var->GetName(), i->GetName());
+  return true;
+}
+
+
+// True if b calls _Halt, so that control never leaves it.
+static bool Halts(BasicBlock *b)
+{
+  for (Optimizer::Iterator p = b->begin; p != b->end; ++p) {
+    LCall *call = dynamic_cast<LCall*>(*p);
+    if (call && strcmp(call->GetLabel(), "_Halt") == 0) return true;
+  }
+  return false;
+}
+
+// Copies the loop body [first, last) onto copies, leaving out skip (the
+// update of var) and reading with wherever var was read. The labels in
+// it are renamed, so it can be pasted in more than once.
+static void CopyBody(Optimizer::Iterator first, Optimizer::Iterator last,
+                     Optimizer::Iterator skip, Location *var, Location *with,
+                     std::list<Instruction*> *copies)
+{
+  std::map<Location*, Location*> vars;
+  std::map<std::string, const char*> labels;
+  for (Optimizer::Iterator p = first; p != last; ++p) {
+    if (Label *label = dynamic_cast<Label*>(*p))
+      labels[label->text()] = CodeGenerator::NewLabel();
+    List<Location*> uses;
+    (*p)->GetUses(&uses);
+    for (int i = 0; i < uses.NumElements(); i++)
+      if (KeyFor(uses.Nth(i)) == KeyFor(var)) vars[uses.Nth(i)] = with;
+  }
+  for (Optimizer::Iterator p = first; p != last; ++p)
+    if (p != skip) copies->push_back(CopyInstruction(*p, vars, labels));
+}
+
+/* Method: UnrollLoops
+ * -------------------
+ * Takes the innermost loops one at a time, with a new flow graph after
+ * each one that is unrolled. The headers already looked at are
+ * remembered, so neither an unrolled loop nor the original left behind
+ * it is taken again. -d unroll reports each loop and how much the
+ * function grew in all.
+ */
+bool Optimizer::UnrollLoops(Iterator begin, Iterator end)
+{
+  const char *name = FunctionName(begin);
+  std::set<std::string> seen;
+  int growth = 0;
+  bool changed = false, unrolled;
+  do {
+    FlowGraph graph(begin, end);
+    graph.ComputeLiveness();
+    graph.FindLoops();
+    unrolled = false;
+    for (unsigned i = 0; i < graph.loops.size() && !unrolled; i++) {
+      Label *header = dynamic_cast<Label*>(*graph.loops[i]->header->begin);
+      if (header && seen.insert(header->text()).second)
+        unrolled = UnrollLoop(&graph, graph.loops[i], name, &growth, &seen);
+    }
+    changed |= unrolled;
+  } while (unrolled);
+  if (changed)
+    PrintDebug("unroll", "%s: grew by %d instructions from unrolling", name, growth);
+  return changed;
+}
+
+/* Method: UnrollLoop
+ * ------------------
+ * A loop is unrolled if it contains no other loop, its header does
+ * nothing but test i rel n to leave it, n is not written in the loop
+ * and i is a basic induction variable stepping towards n, updated in the
+ * block that jumps back to the header. The rest of the loop has to
+ * follow the header in the code, end with that jump and have no other
+ * way out than to an error stub, which halts. Then every iteration that
+ * goes on runs the whole body with i stepped once, so the k-th one
+ * after the current reads i + k * step.
+ *
+ * If i starts at a constant and n is one, the number of iterations is
+ * known, and when it is at most MaxFullUnroll the loop is replaced by
+ * that many copies of the body, each reading a constant instead of i.
+ * Otherwise a loop running UnrollFactor copies of the body per test is
+ * put in front of the original one, which is left to finish the
+ * iterations that remain. It tests i rel n - (factor - 1) * step, so it
+ * only goes round while all of its copies would have run; copy k reads
+ * i + k * step and i is advanced once at the end. If n could be so near
+ * the end of the int range that the new bound wraps around, a test in
+ * front goes straight to the original loop instead.
+ *
+ * The copies may add at most MaxUnrollGrowth instructions to the
+ * function, a smaller factor being tried when the full one does not fit.
+ */
+bool Optimizer::UnrollLoop(FlowGraph *graph, Loop *loop, const char *name,
+                           int *growth, std::set<std::string> *seen)
+{
+  BasicBlock *h = loop->header;
+  Label *header = dynamic_cast<Label*>(*h->begin);
+  IfCmp *test = dynamic_cast<IfCmp*>(h->Last());
+  Iterator second = h->begin;
+  if (!header || !test || *++second != test || loop->latches.size() != 1) return false;
+  for (unsigned i = 0; i < graph->loops.size(); i++)
+    if (graph->loops[i] != loop && loop->Contains(graph->loops[i]->header)) return false;
+  BasicBlock *latch = loop->latches[0];
+  if ((int)loop->body.size() != latch->id - h->id + 1) return false;
+  for (int i = h->id; i <= latch->id; i++)
+    if (!loop->Contains(graph->blocks[i])) return false;
+  Iterator back = latch->end;
+  --back;
+  if (!dynamic_cast<Goto*>(*back) || strcmp(FlowGraph::BranchTarget(*back), header->text()) != 0)
+    return false;
+
+  std::set<std::string> labels; // those in the body
+  int size = 0;                 // instructions in a copy of the body
+  for (Iterator p = h->end; p != back; ++p) {
+    if (Label *label = dynamic_cast<Label*>(*p)) labels.insert(label->text());
+    else size++;
+  }
+  if (labels.count(test->branch_label()) || strcmp(test->branch_label(), header->text()) == 0)
+    return false;
+  std::set<std::string> halting; // the error stubs, which never come back
+  for (unsigned j = 0; j < graph->blocks.size(); j++) {
+    Label *label = dynamic_cast<Label*>(*graph->blocks[j]->begin);
+    if (label && Halts(graph->blocks[j])) halting.insert(label->text());
+  }
+  for (Iterator p = h->end; p != back; ++p) {
+    std::vector<const char*> targets;
+    FlowGraph::BranchTargets(*p, &targets);
+    for (unsigned j = 0; j < targets.size(); j++)
+      if (!labels.count(targets[j]) && !halting.count(targets[j])) return false;
+    if (dynamic_cast<Return*>(*p)) return false;
+  }
+
+  std::map<int, int> writes, onlyValue;
+  std::set<int> liveOnExit;
+  std::map<int, BasicInduction> basics;
+  ScanLoop(graph, loop, &writes, &liveOnExit);
+  FindConstantLocals(graph->blocks.front()->begin, graph->blocks.back()->end, &onlyValue);
+  FindBasicInductions(graph, loop, writes, onlyValue, &basics);
+  Location *i = test->GetOp1(), *n = test->GetOp2();
+  IfCmp::Relation rel = test->GetRelation();
+  if (!IsLocal(i) || !basics.count(i->GetOffset())) return false;
+  BasicInduction &iv = basics[i->GetOffset()];
+  bool up = rel == IfCmp::Ge || rel == IfCmp::Gt, down = rel == IfCmp::Lt || rel == IfCmp::Le;
+  if (iv.block != latch || !((up && iv.step > 0) || (down && iv.step < 0))) return false;
+  if (n->GetSegment() != fpRelative || writes.count(n->GetOffset())) return false;
+  for (Iterator p = iv.update; ++p != back; ) {
+    List<Location*> uses;
+    (*p)->GetUses(&uses);
+    for (int j = 0; j < uses.NumElements(); j++)
+      if (KeyFor(uses.Nth(j)) == KeyFor(i)) return false;
+  }
+  size--; // the update is left out
+  if (size > MaxUnrollSize) {
+    PrintDebug("unroll", "%s: not unrolling the loop at %s, size %d is over %d", name,
+               header->text(), size, MaxUnrollSize);
+    return false;
+  }
+
+  std::map<int, int> none;
+  LoadConstant *init = InitialValue(loop, i);
+  int bound, trips = MaxFullUnroll + 1; // unless known to be fewer
+  bool constantBound = ValueOf(n, none, onlyValue, &bound);
+  if (init && constantBound) {
+    long long x = init->GetValue();
+    int k = 0;
+    while (k <= MaxFullUnroll && x >= INT_MIN && x <= INT_MAX
+           && !IfCmp::Holds(rel, (int)x, bound)) {
+      x += iv.step;
+      k++;
+    }
+    if (x >= INT_MIN && x <= INT_MAX && IfCmp::Holds(rel, (int)x, bound)) trips = k;
+  }
+  int budget = MaxUnrollGrowth - *growth;
+  int fullGrowth = trips * (size + 1) + 2 - (size + 3);
+  bool full = trips <= MaxFullUnroll && fullGrowth <= budget;
+  long long span;
+  bool guard = false;
+  int factor = UnrollFactor;
+  if (!full) {
+    span = (long long)(factor - 1) * iv.step;
+    guard = !(constantBound && bound - span >= INT_MIN && bound - span <= INT_MAX)
+         && !(up && IsArrayLength(graph, n));
+    while (factor >= 2 && factor * size + 2 * factor + 4 + 2 * guard > budget) factor--;
+    if (factor < 2 || trips < factor) {
+      PrintDebug("unroll", "%s: not unrolling the loop at %s, function has grown by %d",
+                 name, header->text(), *growth);
+      return false;
+    }
+    span = (long long)(factor - 1) * iv.step;
+  }
+
+  BeginFunc *frame = dynamic_cast<BeginFunc*>(*graph->blocks.front()->begin);
+  const char *start = NULL;
+  for (unsigned k = 0; k < h->preds.size(); k++) {
+    BasicBlock *pred = h->preds[k];
+    std::vector<const char*> targets;
+    FlowGraph::BranchTargets(pred->Last(), &targets);
+    bool jumps = false;
+    for (unsigned j = 0; j < targets.size(); j++)
+      jumps |= strcmp(targets[j], header->text()) == 0;
+    if (loop->Contains(pred) || !jumps) continue;
+    if (!start) start = CodeGenerator::NewLabel();
+    FlowGraph::Retarget(pred->Last(), header->text(), start);
+  }
+  std::list<Instruction*> unrolled;
+  if (start) unrolled.push_back(new Label(start));
+  char varName[128];
+  if (full) {
+    for (int k = 0; k < trips; k++) {
+      snprintf(varName, sizeof(varName), "%s.u%d", i->GetName(), k);
+      Location *value = NewLocal(frame, varName);
+      unrolled.push_back(new LoadConstant(value, init->GetValue() + k * iv.step));
+      CopyBody(h->end, back, iv.update, i, value, &unrolled);
+    }
+    unrolled.push_back(new LoadConstant(i, init->GetValue() + trips * iv.step));
+    unrolled.push_back(new Goto(test->branch_label()));
+    *growth += fullGrowth;
+    PrintDebug("unroll", "%s: loop at %s fully unrolled, %d iterations", name,
+               header->text(), trips);
+  } else {
+    snprintf(varName, sizeof(varName), "%s.span", i->GetName());
+    Location *distance = NewLocal(frame, varName);
+    snprintf(varName, sizeof(varName), "%s.limit", i->GetName());
+    Location *limit = NewLocal(frame, varName);
+    unrolled.push_back(new LoadConstant(distance, (int)span));
+    unrolled.push_back(new BinaryOp(BinaryOp::Sub, limit, n, distance));
+    if (guard) {
+      snprintf(varName, sizeof(varName), "%s.edge", i->GetName());
+      Location *edge = NewLocal(frame, varName);
+      unrolled.push_back(new LoadConstant(edge, (int)((up ? INT_MIN : INT_MAX) + span)));
+      unrolled.push_back(new IfCmp(up ? IfCmp::Lt : IfCmp::Gt, n, edge, header->text()));
+    }
+    std::vector<Location*> offsets; // k * step for copy k
+    for (int k = 1; k <= factor; k++) {
+      snprintf(varName, sizeof(varName), "%s.u%d.offset", i->GetName(), k);
+      offsets.push_back(NewLocal(frame, varName));
+      unrolled.push_back(new LoadConstant(offsets.back(), k * iv.step));
+    }
+    const char *top = CodeGenerator::NewLabel();
+    seen->insert(top);
+    unrolled.push_back(new Label(top));
+    unrolled.push_back(new IfCmp(rel, i, limit, header->text()));
+    CopyBody(h->end, back, iv.update, i, i, &unrolled);
+    for (int k = 1; k < factor; k++) {
+      snprintf(varName, sizeof(varName), "%s.u%d", i->GetName(), k);
+      Location *value = NewLocal(frame, varName);
+      unrolled.push_back(new BinaryOp(BinaryOp::Add, value, i, offsets[k - 1]));
+      CopyBody(h->end, back, iv.update, i, value, &unrolled);
+    }
+    unrolled.push_back(new BinaryOp(BinaryOp::Add, i, i, offsets.back()));
+    unrolled.push_back(new Goto(top));
+    *growth += factor * size + 2 * factor + 4 + 2 * guard;
+    PrintDebug("unroll", "%s: loop at %s unrolled %d times", name, header->text(), factor);
+  }
+  code.splice(h->begin, unrolled);
+  return true;
+}
+
+
+/* Method: RotateLoops
+ * -------------------
+ * Runs after the other loop passes, which all expect the test that
+ * leaves a loop to be in its header. Takes one loop at a time with a new
+ * flow graph in between. A rotated loop no longer ends with a Goto, so
+ * it is not taken again.
+ */
+bool Optimizer::RotateLoops(Iterator begin, Iterator end)
+{
+  const char *name = FunctionName(begin);
+  bool changed = false, rotated;
+  do {
+    FlowGraph graph(begin, end);
+    graph.FindLoops();
+    rotated = false;
+    for (unsigned i = 0; i < graph.loops.size() && !rotated; i++)
+      rotated = RotateLoop(&graph, graph.loops[i], name);
+    changed |= rotated;
+  } while (rotated);
+  return changed;
+}
+
+/* Method: RotateLoop
+ * ------------------
+ * The front end lays a loop out with the test to leave it in the header
+ * and a Goto back to the header at the end, so every iteration takes
+ * two branches. If the header is at most MaxRotateSize instructions
+ * ending in a branch out of the loop, and the loop's only way back is
+ * such a Goto, the Goto is replaced by a copy of the header with the
+ * test reversed to jump to the top of the body. The header is then run
+ * once, as a guard on entry, and the copy is the only branch back. An
+ * IfZ reversed becomes an IfCmp against a zero constant. If the exit
+ * does not come right after the loop, a Goto to it follows the copy.
+ */
+bool Optimizer::RotateLoop(FlowGraph *graph, Loop *loop, const char *name)
+{
+  BasicBlock *h = loop->header;
+  Label *header = dynamic_cast<Label*>(*h->begin);
+  const char *exit = FlowGraph::BranchTarget(h->Last());
+  if (!header || !exit || dynamic_cast<Goto*>(h->Last()) || h->succs.size() != 2
+      || loop->latches.size() != 1 || loop->latches[0] == h)
+    return false;
+  if (h->id + 1 >= (int)graph->blocks.size() || !loop->Contains(graph->blocks[h->id + 1])
+      || loop->Contains(h->succs[0]) == loop->Contains(h->succs[1]))
+    return false;
+  BasicBlock *latch = loop->latches[0];
+  Iterator back = latch->end;
+  --back;
+  if (!dynamic_cast<Goto*>(*back) || strcmp(FlowGraph::BranchTarget(*back), header->text()) != 0)
+    return false;
+  Iterator first = h->begin, test = h->end;
+  ++first;
+  --test;
+  int size = std::distance(first, test);
+  if (size > MaxRotateSize) return false;
+
+  const char *top; // where the body starts
+  Iterator body = h->end;
+  if (Label *label = dynamic_cast<Label*>(*body)) top = label->text();
+  else if (dynamic_cast<Goto*>(*body)) top = FlowGraph::BranchTarget(*body);
+  else code.insert(body, new Label(top = CodeGenerator::NewLabel()));
+
+  std::list<Instruction*> bottom;
+  for (Iterator p = first; p != test; ++p)
+    bottom.push_back((*p)->Clone());
+  if (IfCmp *cmp = dynamic_cast<IfCmp*>(*test)) {
+    bottom.push_back(new IfCmp(IfCmp::Negate(cmp->GetRelation()), cmp->GetOp1(),
+                               cmp->GetOp2(), top));
+  } else {
+    BeginFunc *frame = dynamic_cast<BeginFunc*>(*graph->blocks.front()->begin);
+    Location *zero = NewLocal(frame, "zero");
+    bottom.push_back(new LoadConstant(zero, 0));
+    bottom.push_back(new IfCmp(IfCmp::Ne, dynamic_cast<IfZ*>(*test)->GetTest(), zero, top));
+  }
+  Label *next = dynamic_cast<Label*>(*latch->end);
+  if (!next || strcmp(next->text(), exit) != 0)
+    bottom.push_back(new Goto(exit));
+  code.erase(back);
+  code.splice(latch->end, bottom);
+  PrintDebug("rotate", "%s: loop at %s rotated, %d instructions of the header copied",
+             name, header->text(), size);
+  return true;
+}
+
+
+/* Method: CompactFrame
+ * --------------------
+ * Every temp got its own frame slot from the CodeGenerator. Here two
+ * locals interfere if one is defined while the other is live (the
+ * source of a copy does not interfere with its destination), and the
+ * locals are greedily colored so that ones that never interfere share
+ * a slot. The slots are renumbered from the first local down and the
+ * BeginFunc is patched with the smaller frame size.
+ */
+void Optimizer::CompactFrame(Iterator begin, Iterator end, const char *name)
+{
+  BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*begin);
+  Assert(beginFunc);
+  FlowGraph graph(begin, end);
+  graph.ComputeLiveness();
+
+  std::map<int, std::set<int> > interferes;
+  std::set<Location*> locals;
+  for (unsigned i = 0; i < graph.blocks.size(); i++) {
+    BasicBlock *b = graph.blocks[i];
+    std::set<int> live = b->liveOut;
+    for (Iterator p = b->end; p != b->begin; ) {
+      Instruction *instr = *--p;
+      List<Location*> used;
+      instr->GetUses(&used);
+      for (int j = 0; j < used.NumElements(); j++)
+        if (IsLocal(used.Nth(j))) locals.insert(used.Nth(j));
+      Location *dst = instr->GetDst();
+      if (dst && IsLocal(dst)) {
+        locals.insert(dst);
+        interferes[dst->GetOffset()]; // even if it interferes with nothing
+        Assign *copy = dynamic_cast<Assign*>(instr);
+        int src = copy ? copy->GetSrc()->GetOffset() : 0;
+        for (std::set<int>::iterator v = live.begin(); v != live.end(); ++v) {
+          if (*v == dst->GetOffset() || *v >= 0 || (copy && *v == src)) continue;
+          interferes[dst->GetOffset()].insert(*v);
+          interferes[*v].insert(dst->GetOffset());
+        }
+      }
+      FlowGraph::StepBackward(instr, &live);
+    }
+  }
+  for (std::set<Location*>::iterator v = locals.begin(); v != locals.end(); ++v)
+    interferes[(*v)->GetOffset()];
+
+  // color in order of the original slots, nearest the fp first
+  std::map<int, int> slot;
+  int numSlots = 0;
+  for (std::map<int, std::set<int> >::reverse_iterator v = interferes.rbegin();
+       v != interferes.rend(); ++v) {
+    std::set<int> taken;
+    for (std::set<int>::iterator w = v->second.begin(); w != v->second.end(); ++w)
+      if (slot.count(*w)) taken.insert(slot[*w]);
+    int s = 0;
+    while (taken.count(s)) s++;
+    slot[v->first] = s;
+    numSlots = std::max(numSlots, s + 1);
+  }
+  for (std::set<Location*>::iterator v = locals.begin(); v != locals.end(); ++v)
+    (*v)->SetOffset(CodeGenerator::OffsetToFirstLocal
+                    - CodeGenerator::VarSize * slot[(*v)->GetOffset()]);
+
+  int oldSize = beginFunc->GetFrameSize(), newSize = numSlots * CodeGenerator::VarSize;
+  beginFunc->SetFrameSize(newSize);
+  PrintDebug("frame", "%s: frame %d -> %d bytes, %d saved", name, oldSize,
+             newSize, oldSize - newSize);
+}
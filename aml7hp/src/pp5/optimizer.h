@@ -0,0 +1,151 @@
+/* File: optimizer.h
+ * -----------------
+ * The Optimizer class rewrites the list of Tac instructions built by
+ * the CodeGenerator before it is handed to final code generation (or
+ * printed with -d tac). Each pass works on one function at a time,
+ * i.e. the instructions from its BeginFunc through its EndFunc, and
+ * the passes are repeated until none of them finds anything to change.
+ *
+ * Once every function has been simplified this way, calls to small
+ * functions are inlined (-d inline shows which), then calls in tail
+ * position are turned into jumps, and the functions changed are
+ * simplified again. Then array bounds checks that cannot fail are
+ * removed, loop-invariant computations are moved out of the loops
+ * that contain them (-d licm lists them), counted loops are unrolled,
+ * array indexing in loops is strength reduced to pointers stepping
+ * through the arrays and each loop is rotated to test at the bottom.
+ *
+ * With -d cfg, the flow graph and liveness of each optimized function
+ * are printed.
+ *
+ * Only variables in the stack frame are tracked. Globals can be changed
+ * behind our back by any call, so they are always left alone.
+ */
+
+#ifndef _H_optimizer
+#define _H_optimizer
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include "tac.h"
+
+class FlowGraph;
+class Loop;
+
+class Optimizer {
+  public:
+    typedef std::list<Instruction*>::iterator Iterator;
+
+         // Limits on inlining: the size of a callee's body and how much
+         // one function may grow from the calls inlined into it
+    static const int MaxInlineSize = 24, MaxInlineGrowth = 240;
+
+         // Limits on unrolling: how many copies of the body an unrolled
+         // loop runs per test, the size of a body that is copied, the
+         // most iterations replaced by straight-line code and how much
+         // one function may grow from the loops unrolled in it
+    static const int UnrollFactor = 4, MaxUnrollSize = 16, MaxFullUnroll = 8,
+                     MaxUnrollGrowth = 160;
+
+         // The most instructions ahead of a loop's test that are copied
+         // to the bottom when it is rotated
+    static const int MaxRotateSize = 8;
+
+  private:
+    std::list<Instruction*> &code;
+    std::map<std::string, Iterator> functions; // BeginFunc by label
+
+    void Simplify(Iterator begin, Iterator end); // runs the passes below
+    Iterator FunctionEnd(Iterator begin);
+    const char *FunctionName(Iterator begin);
+
+         // Constant folding and propagation. Tracks which frame variables
+         // hold known constants, replaces BinaryOps whose operands are all
+         // known with a LoadConstant and turns an IfZ on a known value
+         // or IfCmp on known values into a Goto (or removes it). Returns
+         // true if anything changed.
+    bool FoldConstants(Iterator begin, Iterator end);
+
+         // Local value numbering. Within each block, finds BinaryOps,
+         // Loads and constants that recompute a value some variable
+         // already holds and reuses that variable instead. Stores and
+         // calls invalidate remembered memory values (calls also those of
+         // globals).
+    bool NumberValues(Iterator begin, Iterator end);
+
+         // Merges a comparison into the IfZ that tests it, giving an IfCmp
+    bool FuseBranches(Iterator begin, Iterator end);
+
+         // Jump threading and removal of branches to the next instruction
+         // and of labels nothing jumps to
+    bool CleanUpBranches(Iterator begin, Iterator end);
+
+         // Moves constant displacements added to an address into the
+         // offset field of the Loads and Stores through it
+    bool FoldAddressOffsets(Iterator begin, Iterator end);
+
+         // Dead code elimination on the function's flow graph: removes
+         // unreachable blocks and side-effect free instructions whose
+         // results are not live.
+    bool RemoveDeadCode(Iterator begin, Iterator end);
+
+         // Replaces calls to small functions by a copy of their code
+    bool InlineCalls(Iterator begin, Iterator end);
+    Iterator InlineCall(Iterator call, Iterator body, Iterator bodyEnd,
+                        BeginFunc *frame, Iterator endFunc);
+
+         // Turns self-recursive tail calls into loops and marks other
+         // tail calls so they reuse the frame (see -d tailcall)
+    bool EliminateTailCalls(Iterator begin, Iterator end);
+
+         // Range analysis: removes the branches, in particular array
+         // bounds checks, whose outcome follows from what is known about
+         // the values compared (-d bounds counts the tests removed)
+    bool RemoveBoundsChecks(Iterator begin, Iterator end);
+
+         // Loop-invariant code motion: moves computations whose operands
+         // do not change in a loop to a preheader run once before it
+    bool HoistInvariants(Iterator begin, Iterator end);
+    bool HoistFromLoop(FlowGraph *graph, Loop *loop, const char *name);
+
+         // Returns where code to run once before entering the loop goes,
+         // adding a block between its header and its entries if needed
+    Iterator Preheader(FlowGraph *graph, Loop *loop);
+
+         // Loop unrolling: counted loops run several copies of their body
+         // per test, those with a few known iterations become straight-line
+         // code (-d unroll reports both and the growth)
+    bool UnrollLoops(Iterator begin, Iterator end);
+    bool UnrollLoop(FlowGraph *graph, Loop *loop, const char *name, int *growth,
+                    std::set<std::string> *seen);
+
+         // Induction variable strength reduction: a multiply by a loop
+         // counter, or an address computed from one, becomes a variable
+         // advanced by a constant each iteration, and a counter only
+         // used by the loop test is replaced there by such a variable
+         // (-d iv reports both)
+    bool ReduceInductionVariables(Iterator begin, Iterator end);
+    bool ReduceInLoop(FlowGraph *graph, Loop *loop, const char *name);
+    bool ReplaceLoopTest(FlowGraph *graph, Loop *loop, const char *name);
+
+         // Loop rotation: the test at the top of a loop is copied to its
+         // bottom as the branch back, leaving the top one to guard the
+         // entry (-d rotate lists the loops)
+    bool RotateLoops(Iterator begin, Iterator end);
+    bool RotateLoop(FlowGraph *graph, Loop *loop, const char *name);
+
+         // Run once the other passes are done: lets locals whose live
+         // ranges do not overlap share a stack slot and shrinks the frame
+         // size in the BeginFunc to match. -d frame reports the savings.
+    void CompactFrame(Iterator begin, Iterator end, const char *name);
+
+  public:
+    Optimizer(std::list<Instruction*> &code);
+
+         // Runs all of the passes over every function in the program
+    void Optimize();
+};
+
+#endif
@@ -35,6 +35,8 @@ void yyerror(const char *msg); // standard error-handling routine
     List<Expr*> *exprList;
     Stmt *stmt;
     List<Stmt*> *stmtList;
+    CaseStmt *caseStmt;
+    List<CaseStmt*> *caseList;
     LValue *lvalue;
 }
 
@@ -46,6 +48,7 @@ void yyerror(const char *msg); // standard error-handling routine
 %token   T_LessEqual T_GreaterEqual T_Equal T_NotEqual T_Dims
 %token   T_And T_Or T_Null T_Extends T_This T_Interface T_Implements
 %token   T_While T_For T_If T_Else T_Return T_Break
+%token   T_Switch T_Case T_Default
 %token   T_New T_NewArray T_Print T_ReadInteger T_ReadLine
 
 %token   <identifier> T_Identifier
@@ -71,6 +74,8 @@ void yyerror(const char *msg); // standard error-handling routine
 %type <exprList>  Actuals ExprList
 %type <stmt>      Stmt StmtBlock OptElse
 %type <stmtList>  StmtList
+%type <caseStmt>  Case OptDefault
+%type <caseList>  CaseList
 
   
 /* Precedence and associativity
@@ -211,6 +216,22 @@ Stmt      :    OptExpr ';'          { $$ = $1; }
           |    T_Print '(' ExprList ')' ';'  
                                     { $$ = new PrintStmt($3); }
           |    T_Break ';'          { $$ = new BreakStmt(@1); }
+          |    T_Switch '(' Expr ')' '{' CaseList OptDefault '}'
+                                    { if ($7) $6->Append($7);
+                                      $$ = new SwitchStmt($3, $6); }
+          ;
+
+CaseList  :    CaseList Case        { ($$=$1)->Append($2); }
+          |    Case                 { ($$ = new List<CaseStmt*>)->Append($1); }
+          ;
+
+Case      :    T_Case T_IntConstant ':' StmtList
+                                    { $$ = new CaseStmt(new IntConstant(@2, $2), $4); }
+          ;
+
+OptDefault:    T_Default ':' StmtList
+                                    { $$ = new CaseStmt(NULL, $3); }
+          |    /* empty */          { $$ = NULL; }
           ;
 
 LValue    :    T_Identifier          { $$ = new FieldAccess(NULL, new Identifier(@1, $1)); }
@@ -0,0 +1,366 @@
+/* File: ranges.cc
+ * ---------------
+ * Implementation of the RangeFacts class.
+ */
+
+#include "ranges.h"
+#include <climits>
+#include <vector>
+
+// Only variables in the stack frame are followed.
+static bool Tracked(Location *var)
+{
+  return var->GetSegment() == fpRelative;
+}
+
+void RangeFacts::Add(Term a, Term b, bool strict)
+{
+  if (a == b || (a.first == Constant && b.first == Constant))
+    return; // constants are compared directly
+  bool &s = facts[std::make_pair(a, b)];
+  s = s || strict;
+}
+
+/* Method: Proves
+ * --------------
+ * Searches the facts for a chain leading up from a, remembering whether
+ * some step in it was strict. From a constant the chain may continue to
+ * the next larger one that something is known to be below. Reaching
+ * constant c (or any variable, which is at most INT_MAX) shows a <= c,
+ * or a <= c - 1 if the chain was strict, which is enough when b is a
+ * constant at least that large.
+ */
+bool RangeFacts::Proves(Term a, Term b, bool strict) const
+{
+  if (a == b) return !strict;
+  if (a.first == Constant && a.second == INT_MIN && !strict) return true;
+
+  std::map<Term, int> best; // 1 if reached by a strict chain, else 0
+  std::vector<std::pair<Term, int> > stack(1, std::make_pair(a, 0));
+  while (!stack.empty()) {
+    Term t = stack.back().first;
+    int s = stack.back().second;
+    stack.pop_back();
+    std::map<Term, int>::iterator seen = best.find(t);
+    if (seen != best.end() && seen->second >= s) continue;
+    best[t] = s;
+
+    if (t == b && s >= strict) return true;
+    long long bound = (t.first == Constant ? t.second : INT_MAX);
+    if (b.first == Constant && bound - s <= (long long)b.second - strict) return true;
+
+    FactMap::const_iterator f = facts.lower_bound(std::make_pair(t, Term(INT_MIN, INT_MIN)));
+    for (; f != facts.end() && f->first.first == t; ++f)
+      stack.push_back(std::make_pair(f->first.second, (s || f->second) ? 1 : 0));
+    if (t.first == Constant && f != facts.end() && f->first.first.first == Constant)
+      stack.push_back(std::make_pair(f->first.first, 1)); // the next constant
+  }
+  return false;
+}
+
+bool RangeFacts::ValueOf(Term a, int *value) const
+{
+  FactMap::const_iterator f = facts.lower_bound(std::make_pair(a, Term(INT_MIN, INT_MIN)));
+  for (; f != facts.end() && f->first.first == a; ++f) {
+    Term c = f->first.second;
+    if (c.first != Constant || f->second) continue;
+    FactMap::const_iterator back = facts.find(std::make_pair(c, a));
+    if (back != facts.end() && !back->second) {
+      *value = c.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RangeFacts::ValueOf(Location *var, int *value)
+{
+  return Tracked(var) && ValueOf(Var(var), value);
+}
+
+
+// Removes a from the facts after joining each fact below it to each
+// fact above it, so that x < a and a <= y still leave x < y. If nothing
+// was known above a, x < a still shows x < INT_MAX (and likewise below).
+void RangeFacts::Forget(Term a)
+{
+  std::vector<std::pair<Term, bool> > below, above;
+  for (FactMap::iterator f = facts.begin(); f != facts.end(); ) {
+    if (f->first.second == a) below.push_back(std::make_pair(f->first.first, f->second));
+    else if (f->first.first == a) above.push_back(std::make_pair(f->first.second, f->second));
+    else { ++f; continue; }
+    facts.erase(f++);
+  }
+  for (unsigned i = 0; i < below.size(); i++)
+    for (unsigned j = 0; j < above.size(); j++)
+      Add(below[i].first, above[j].first, below[i].second || above[j].second);
+  for (unsigned i = 0; i < below.size() && above.empty(); i++)
+    if (below[i].second) Add(below[i].first, Const(INT_MAX), true);
+  for (unsigned j = 0; j < above.size() && below.empty(); j++)
+    if (above[j].second) Add(Const(INT_MIN), above[j].first, true);
+}
+
+void RangeFacts::Rename(Term from, Term to)
+{
+  std::vector<std::pair<std::pair<Term, Term>, bool> > renamed;
+  for (FactMap::iterator f = facts.begin(); f != facts.end(); ) {
+    if (f->first.first != from && f->first.second != from) { ++f; continue; }
+    renamed.push_back(*f);
+    facts.erase(f++);
+  }
+  for (unsigned i = 0; i < renamed.size(); i++) {
+    Term a = renamed[i].first.first, b = renamed[i].first.second;
+    Add(a == from ? to : a, b == from ? to : b, renamed[i].second);
+  }
+}
+
+void RangeFacts::Define(Location *var)
+{
+  Forget(Var(var));
+  Forget(LengthOf(var));
+}
+
+void RangeFacts::Prune(const std::set<int> &live)
+{
+  std::set<int> dead;
+  for (FactMap::iterator f = facts.begin(); f != facts.end(); ++f) {
+    Term a = f->first.first, b = f->first.second;
+    if (a.first == Variable && !live.count(a.second)) dead.insert(a.second);
+    if (b.first == Variable && !live.count(b.second)) dead.insert(b.second);
+  }
+  for (std::set<int>::iterator v = dead.begin(); v != dead.end(); ++v) {
+    Forget(Term(Variable, *v));
+    Forget(Term(Length, *v));
+  }
+}
+
+
+// Keeps the facts of from that also hold in this, weakening a < b to
+// a <= b if need be, and the bounds showing that a variable cannot be
+// INT_MAX (or INT_MIN) if that holds in both. Those are what show that
+// adding to (subtracting from) it cannot wrap around.
+void RangeFacts::KeepCommon(const FactMap &from, const RangeFacts &other,
+                            FactMap *kept) const
+{
+  std::set<Term> terms;
+  for (FactMap::const_iterator f = from.begin(); f != from.end(); ++f) {
+    Term a = f->first.first, b = f->first.second;
+    bool strict = f->second && Proves(a, b, true) && other.Proves(a, b, true);
+    if (strict || (Proves(a, b, false) && other.Proves(a, b, false)))
+      (*kept)[f->first] = (*kept)[f->first] || strict;
+    if (a.first != Constant) terms.insert(a);
+    if (b.first != Constant) terms.insert(b);
+  }
+  Term top = Const(INT_MAX), bottom = Const(INT_MIN);
+  for (std::set<Term>::iterator t = terms.begin(); t != terms.end(); ++t) {
+    if (Proves(*t, top, true) && other.Proves(*t, top, true))
+      (*kept)[std::make_pair(*t, top)] = true;
+    if (Proves(bottom, *t, true) && other.Proves(bottom, *t, true))
+      (*kept)[std::make_pair(bottom, *t)] = true;
+  }
+}
+
+void RangeFacts::Meet(const RangeFacts &other)
+{
+  if (!other.reached) return;
+  if (!reached) {
+    *this = other;
+    return;
+  }
+  if (facts == other.facts) return;
+  FactMap kept;
+  KeepCommon(facts, other, &kept);
+  KeepCommon(other.facts, other, &kept);
+  facts.swap(kept);
+}
+
+void RangeFacts::Widen(const RangeFacts &previous)
+{
+  if (!previous.reached || facts == previous.facts) return;
+  FactMap kept;
+  KeepCommon(previous.facts, previous, &kept);
+  facts.swap(kept);
+}
+
+
+/* Method: Apply
+ * -------------
+ * What is learned about the new value of the destination is first
+ * recorded against a stand-in Result term, so it may be worked out from
+ * the old value of the same variable. Sums and differences with a
+ * constant are only related to their operand when they cannot wrap
+ * around.
+ */
+void RangeFacts::Apply(Instruction *instr)
+{
+  Store *store = dynamic_cast<Store*>(instr);
+  if (store && store->GetOffset() == 0 && Tracked(store->GetAddr())) {
+    Forget(LengthOf(store->GetAddr())); // the array or object is being made
+    if (Tracked(store->GetSrc()))
+      AddEqual(LengthOf(store->GetAddr()), Var(store->GetSrc()));
+    return;
+  }
+
+  Location *dst = instr->GetDst();
+  if (!dst || !Tracked(dst)) return;
+  Term result(Result, 0), resultLength(Result, 1);
+  LoadConstant *lc = dynamic_cast<LoadConstant*>(instr);
+  Assign *assign = dynamic_cast<Assign*>(instr);
+  Load *load = dynamic_cast<Load*>(instr);
+  BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+  UnaryOp *unary = dynamic_cast<UnaryOp*>(instr);
+  int a, b;
+  if (lc) {
+    AddEqual(result, Const(lc->GetValue()));
+  } else if (assign && Tracked(assign->GetSrc())) {
+    AddEqual(result, Var(assign->GetSrc()));
+    AddEqual(resultLength, LengthOf(assign->GetSrc()));
+  } else if (load && load->GetOffset() == 0 && Tracked(load->GetSrc())) {
+    AddEqual(result, LengthOf(load->GetSrc()));
+    Add(Const(0), result, false); // a length or an address
+  } else if (unary && Tracked(unary->GetSrc())) {
+    if (ValueOf(Var(unary->GetSrc()), &a)) AddEqual(result, Const(!a));
+  } else if (op && Tracked(op->GetOp1()) && Tracked(op->GetOp2())) {
+    Term x = Var(op->GetOp1()), y = Var(op->GetOp2());
+    bool knowA = ValueOf(x, &a), knowB = ValueOf(y, &b);
+    switch (op->GetOpCode()) {
+      case BinaryOp::Add:
+        if (knowB) AddOffset(result, x, b);
+        else if (knowA) AddOffset(result, y, a);
+        break;
+      case BinaryOp::Sub:
+        if (knowB && b != INT_MIN) AddOffset(result, x, -b);
+        break;
+      case BinaryOp::Div:
+        if (knowB && b > 0 && Proves(Const(0), x, false)) {
+          Add(Const(0), result, false);
+          Add(result, x, false);
+        }
+        break;
+      case BinaryOp::Mod:
+        if (knowB && b > 0 && Proves(Const(0), x, false)) {
+          Add(Const(0), result, false);
+          Add(result, Const(b), true);
+        }
+        break;
+      case BinaryOp::Less:
+      case BinaryOp::Ge:
+        if (Proves(x, y, true)) AddEqual(result, Const(op->GetOpCode() == BinaryOp::Less));
+        else if (Proves(y, x, false)) AddEqual(result, Const(op->GetOpCode() == BinaryOp::Ge));
+        break;
+      case BinaryOp::Le:
+      case BinaryOp::Gt:
+        if (Proves(x, y, false)) AddEqual(result, Const(op->GetOpCode() == BinaryOp::Le));
+        else if (Proves(y, x, true)) AddEqual(result, Const(op->GetOpCode() == BinaryOp::Gt));
+        break;
+      case BinaryOp::Eq:
+      case BinaryOp::Ne:
+        if (Proves(x, y, true) || Proves(y, x, true))
+          AddEqual(result, Const(op->GetOpCode() == BinaryOp::Ne));
+        else if (Proves(x, y, false) && Proves(y, x, false))
+          AddEqual(result, Const(op->GetOpCode() == BinaryOp::Eq));
+        break;
+      case BinaryOp::And:
+        if ((knowA && a == 0) || (knowB && b == 0)) AddEqual(result, Const(0));
+        else if (knowA && knowB) AddEqual(result, Const(a & b));
+        break;
+      case BinaryOp::Or:
+        if (knowA && knowB) AddEqual(result, Const(a | b));
+        else if (knowA && a == 0) AddEqual(result, y);
+        else if (knowB && b == 0) AddEqual(result, x);
+        break;
+      default:
+        break;
+    }
+  }
+  Define(dst);
+  Rename(result, Var(dst));
+  Rename(resultLength, LengthOf(dst));
+}
+
+// Records what is known about result = x + k.
+void RangeFacts::AddOffset(Term result, Term x, int k)
+{
+  if (k == 0) {
+    AddEqual(result, x);
+    return;
+  }
+  if (k > 0 ? !Proves(x, Const(INT_MAX - k), false) : !Proves(Const(INT_MIN - k), x, false))
+    return; // might wrap around
+
+  std::vector<std::pair<Term, bool> > below, above;
+  for (FactMap::iterator f = facts.begin(); f != facts.end(); ++f) {
+    if (f->first.second == x) below.push_back(std::make_pair(f->first.first, f->second));
+    if (f->first.first == x) above.push_back(std::make_pair(f->first.second, f->second));
+  }
+  if (k > 0) Add(x, result, true);
+  else Add(result, x, true);
+  for (unsigned i = 0; i < below.size(); i++) {
+    Term z = below[i].first;
+    if (z.first == Constant) {
+      long long c = (long long)z.second + k;
+      if (c >= INT_MIN) Add(Const(c), result, below[i].second);
+    } else if (k > 0) {
+      Add(z, result, true);
+    } else if (k == -1 && below[i].second) {
+      Add(z, result, false);
+    }
+  }
+  for (unsigned i = 0; i < above.size(); i++) {
+    Term z = above[i].first;
+    if (z.first == Constant) {
+      long long c = (long long)z.second + k;
+      if (c <= INT_MAX) Add(result, Const(c), above[i].second);
+    } else if (k < 0) {
+      Add(result, z, true);
+    } else if (k == 1 && above[i].second) {
+      Add(result, z, false);
+    }
+  }
+}
+
+
+void RangeFacts::Assume(IfCmp::Relation rel, Location *a, Location *b)
+{
+  if (!Tracked(a) || !Tracked(b)) return;
+  Term x = Var(a), y = Var(b);
+  switch (rel) {
+    case IfCmp::Eq: AddEqual(x, y); break;
+    case IfCmp::Lt: Add(x, y, true); break;
+    case IfCmp::Le: Add(x, y, false); break;
+    case IfCmp::Gt: Add(y, x, true); break;
+    case IfCmp::Ge: Add(y, x, false); break;
+    default: break;
+  }
+}
+
+bool RangeFacts::Decides(IfCmp::Relation rel, Location *a, Location *b, bool *holds)
+{
+  if (!Tracked(a) || !Tracked(b)) return false;
+  Term x = Var(a), y = Var(b);
+  switch (rel) {
+    case IfCmp::Eq:
+      if (Proves(x, y, true) || Proves(y, x, true)) *holds = false;
+      else if (Proves(x, y, false) && Proves(y, x, false)) *holds = true;
+      else return false;
+      return true;
+    case IfCmp::Lt:
+      if (Proves(x, y, true)) *holds = true;
+      else if (Proves(y, x, false)) *holds = false;
+      else return false;
+      return true;
+    case IfCmp::Le:
+      if (Proves(x, y, false)) *holds = true;
+      else if (Proves(y, x, true)) *holds = false;
+      else return false;
+      return true;
+    case IfCmp::Gt:
+      return Decides(IfCmp::Lt, b, a, holds);
+    case IfCmp::Ge:
+      return Decides(IfCmp::Le, b, a, holds);
+    default:
+      if (!Decides(IfCmp::Eq, a, b, holds)) return false;
+      *holds = !*holds;
+      return true;
+  }
+}
@@ -0,0 +1,83 @@
+/* File: ranges.h
+ * --------------
+ * RangeFacts records what is known at one point in a function about how
+ * values compare, as a set of facts a < b or a <= b. Each side is a
+ * frame variable, a constant, or the length of the array a frame
+ * variable points to. A question such as "is i < length(arr)?" is
+ * answered by following chains of facts, so i < n and n <= length(arr)
+ * together show it. Constants are ordered among themselves.
+ *
+ * The word a pointer points at (the length of an array, the vtable of
+ * an object) is only written right after the array or object is
+ * allocated, before any other variable can point at it, so it is treated
+ * as a value that only changes when the pointer does.
+ *
+ * Optimizer::RemoveBoundsChecks carries these facts forward through the
+ * flow graph to find the branches whose outcome is already known.
+ */
+
+#ifndef _H_ranges
+#define _H_ranges
+
+#include <map>
+#include <set>
+#include <utility>
+#include "tac.h"
+
+class RangeFacts {
+  public:
+    typedef enum { Variable, Length, Constant, Result } Kind;
+    typedef std::pair<int, int> Term; // kind and fp offset or value
+
+    bool reached; // false until some path to this point has been seen
+
+    RangeFacts() : reached(false) {}
+    bool operator==(const RangeFacts &other) const
+      { return reached == other.reached && facts == other.facts; }
+
+         // Keeps only what holds both here and in other (the facts where
+         // two paths meet)
+    void Meet(const RangeFacts &other);
+
+         // Keeps only those of previous's facts that still hold. Used at
+         // a loop header that keeps changing, so the facts there can only
+         // shrink and the iteration ends.
+    void Widen(const RangeFacts &previous);
+
+         // Updates the facts to hold after instr runs
+    void Apply(Instruction *instr);
+
+         // Adds what is known on the edge where a rel b is true
+    void Assume(IfCmp::Relation rel, Location *a, Location *b);
+
+         // Drops the frame variables that are not in live (fp offsets),
+         // keeping what they showed about the others
+    void Prune(const std::set<int> &live);
+
+         // True if rel is known to hold (*holds) or not to hold (!*holds)
+         // between a and b
+    bool Decides(IfCmp::Relation rel, Location *a, Location *b, bool *holds);
+
+         // True if var is known to hold a single constant
+    bool ValueOf(Location *var, int *value);
+
+  private:
+    typedef std::map<std::pair<Term, Term>, bool> FactMap;
+    FactMap facts; // (a, b) -> a < b (else a <= b)
+
+    static Term Var(Location *var)  { return Term(Variable, var->GetOffset()); }
+    static Term LengthOf(Location *var) { return Term(Length, var->GetOffset()); }
+    static Term Const(int value)    { return Term(Constant, value); }
+
+    void Add(Term a, Term b, bool strict);
+    void AddEqual(Term a, Term b) { Add(a, b, false); Add(b, a, false); }
+    bool Proves(Term a, Term b, bool strict) const;
+    bool ValueOf(Term a, int *value) const;
+    void Forget(Term a);
+    void Rename(Term from, Term to);
+    void AddOffset(Term result, Term x, int k);
+    void KeepCommon(const FactMap &from, const RangeFacts &other, FactMap *kept) const;
+    void Define(Location *var);
+};
+
+#endif
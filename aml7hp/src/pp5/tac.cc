@@ -8,7 +8,8 @@
 #include <cstring>
 
 Location::Location(Segment s, int o, const char *name) :
-  variableName(strdup(name)), segment(s), offset(o), base(NULL), type(NULL) {}
+  variableName(strdup(name)), segment(s), offset(o), base(NULL), type(NULL),
+  elemType(NULL), classInfo(NULL) {}
 
  
 void Instruction::Print() {
@@ -30,6 +31,9 @@ LoadConstant::LoadConstant(Location *d, int v)
 void LoadConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadConstant(dst, val);
 }
+void LoadConstant::ReplaceDst(Location *with) {
+  *this = LoadConstant(with, val);
+}
 
 
 LoadStringConstant::LoadStringConstant(Location *d, const char *s)
@@ -44,6 +48,9 @@ LoadStringConstant::LoadStringConstant(Location *d, const char *s)
 void LoadStringConstant::EmitSpecific(Mips *mips) {
   mips->EmitLoadStringConstant(dst, str);
 }
+void LoadStringConstant::ReplaceDst(Location *with) {
+  *this = LoadStringConstant(with, str);
+}
      
 
 LoadLabel::LoadLabel(Location *d, const char *l)
@@ -54,6 +61,9 @@ LoadLabel::LoadLabel(Location *d, const char *l)
 void LoadLabel::EmitSpecific(Mips *mips) {
   mips->EmitLoadLabel(dst, label);
 }
+void LoadLabel::ReplaceDst(Location *with) {
+  *this = LoadLabel(with, label);
+}
 
 
 Assign::Assign(Location *d, Location *s)
@@ -64,6 +74,12 @@ Assign::Assign(Location *d, Location *s)
 void Assign::EmitSpecific(Mips *mips) {
   mips->EmitCopy(dst, src);
 }
+void Assign::ReplaceUse(Location *var, Location *with) {
+  *this = Assign(dst, with);
+}
+void Assign::ReplaceDst(Location *with) {
+  *this = Assign(with, src);
+}
 
 
 Load::Load(Location *d, Location *s, int off)
@@ -77,6 +93,12 @@ Load::Load(Location *d, Location *s, int off)
 void Load::EmitSpecific(Mips *mips) {
   mips->EmitLoad(dst, src, offset);
 }
+void Load::ReplaceUse(Location *var, Location *with) {
+  *this = Load(dst, with, offset);
+}
+void Load::ReplaceDst(Location *with) {
+  *this = Load(with, src, offset);
+}
 
 
 Store::Store(Location *d, Location *s, int off)
@@ -90,9 +112,12 @@ Store::Store(Location *d, Location *s, int off)
 void Store::EmitSpecific(Mips *mips) {
   mips->EmitStore(dst, src, offset);
 }
+void Store::ReplaceUse(Location *var, Location *with) {
+  *this = Store(dst == var ? with : dst, src == var ? with : src, offset);
+}
 
  
-const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||"};;
+const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=", "&&", "||"};;
 
 BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
   for (int i = 0; i < NumOps; i++) 
@@ -102,6 +127,16 @@ BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
   return Add; // can't get here, but compiler doesn't know that
 }
 
+BinaryOp::OpCode BinaryOp::Mirror(OpCode code) {
+  switch (code) {
+    case Less: return Gt;
+    case Le:   return Ge;
+    case Gt:   return Less;
+    case Ge:   return Le;
+    default:   return code;
+  }
+}
+
 BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, Location *o2)
   : code(c), dst(d), op1(o1), op2(o2) {
   Assert(dst != NULL && op1 != NULL && op2 != NULL);
@@ -111,6 +146,39 @@ BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, Location *o2)
 void BinaryOp::EmitSpecific(Mips *mips) {	  
   mips->EmitBinaryOp(code, dst, op1, op2);
 }
+void BinaryOp::ReplaceUse(Location *var, Location *with) {
+  *this = BinaryOp(code, dst, op1 == var ? with : op1, op2 == var ? with : op2);
+}
+void BinaryOp::ReplaceDst(Location *with) {
+  *this = BinaryOp(code, with, op1, op2);
+}
+
+
+const char * const UnaryOp::opName[UnaryOp::NumOps]  = {"!"};
+
+UnaryOp::OpCode UnaryOp::OpCodeForName(const char *name) {
+  for (int i = 0; i < NumOps; i++)
+    if (!strcmp(opName[i], name))
+	return (OpCode)i;
+  Failure("Unrecognized Tac operator: '%s'\n", name);
+  return Not;
+}
+
+UnaryOp::UnaryOp(OpCode c, Location *d, Location *s)
+  : code(c), dst(d), src(s) {
+  Assert(dst != NULL && src != NULL);
+  Assert(code >= 0 && code < NumOps);
+  sprintf(printed, "%s = %s %s", dst->GetName(), opName[code], src->GetName());
+}
+void UnaryOp::EmitSpecific(Mips *mips) {
+  mips->EmitUnaryOp(code, dst, src);
+}
+void UnaryOp::ReplaceUse(Location *var, Location *with) {
+  *this = UnaryOp(code, dst, with);
+}
+void UnaryOp::ReplaceDst(Location *with) {
+  *this = UnaryOp(code, with, src);
+}
 
 Label::Label(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
@@ -122,6 +190,9 @@ void Label::Print() {
 void Label::EmitSpecific(Mips *mips) {
   mips->EmitLabel(label);
 }
+void Label::ReplaceLabel(const char *with) {
+  *this = Label(with);
+}
  
 Goto::Goto(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
@@ -130,6 +201,9 @@ Goto::Goto(const char *l) : label(strdup(l)) {
 void Goto::EmitSpecific(Mips *mips) {	  
   mips->EmitGoto(label);
 }
+void Goto::ReplaceLabel(const char *with) {
+  *this = Goto(with);
+}
 
 IfZ::IfZ(Location *te, const char *l)
    : test(te), label(strdup(l)) {
@@ -139,10 +213,84 @@ IfZ::IfZ(Location *te, const char *l)
 void IfZ::EmitSpecific(Mips *mips) {	  
   mips->EmitIfZ(test, label);
 }
+void IfZ::ReplaceUse(Location *var, Location *with) {
+  *this = IfZ(with, label);
+}
+void IfZ::ReplaceLabel(const char *with) {
+  *this = IfZ(test, with);
+}
+
+
+const char * const IfCmp::relationName[IfCmp::NumRelations] = {"==", "!=", "<", "<=", ">", ">="};
+
+IfCmp::Relation IfCmp::RelationForName(const char *name) {
+  for (int i = 0; i < NumRelations; i++)
+    if (!strcmp(relationName[i], name))
+      return (Relation)i;
+  Failure("Unrecognized Tac relation: '%s'\n", name);
+  return Eq; // can't get here, but compiler doesn't know that
+}
+
+IfCmp::Relation IfCmp::Negate(Relation rel) {
+  static const Relation negated[NumRelations] = {Ne, Eq, Ge, Gt, Le, Lt};
+  return negated[rel];
+}
+
+bool IfCmp::Holds(Relation rel, int a, int b) {
+  switch (rel) {
+    case Eq: return a == b;
+    case Ne: return a != b;
+    case Lt: return a < b;
+    case Le: return a <= b;
+    case Gt: return a > b;
+    default: return a >= b;
+  }
+}
+
+IfCmp::IfCmp(Relation r, Location *o1, Location *o2, const char *l)
+  : rel(r), op1(o1), op2(o2), label(strdup(l)) {
+  Assert(op1 != NULL && op2 != NULL && label != NULL);
+  Assert(rel >= 0 && rel < NumRelations);
+  sprintf(printed, "If %s %s %s Goto %s", op1->GetName(), relationName[rel],
+	  op2->GetName(), label);
+}
+void IfCmp::EmitSpecific(Mips *mips) {
+  mips->EmitIfCmp(rel, op1, op2, label);
+}
+void IfCmp::ReplaceUse(Location *var, Location *with) {
+  *this = IfCmp(rel, op1 == var ? with : op1, op2 == var ? with : op2, label);
+}
+void IfCmp::ReplaceLabel(const char *with) {
+  *this = IfCmp(rel, op1, op2, with);
+}
+
+JumpTable::JumpTable(Location *i, const std::vector<const char*> &t)
+  : index(i), targets(t) {
+  Assert(index != NULL && !targets.empty());
+  sprintf(printed, "JumpTable %s (%d targets)", index->GetName(), (int)targets.size());
+}
+void JumpTable::Print() {
+  printf("\tJumpTable %s =\n", index->GetName());
+  for (unsigned i = 0; i < targets.size(); i++)
+    printf("\t\t%s,\n", targets[i]);
+  printf("\t;\n");
+}
+void JumpTable::EmitSpecific(Mips *mips) {
+  mips->EmitJumpTable(index, targets);
+}
+void JumpTable::ReplaceUse(Location *var, Location *with) {
+  *this = JumpTable(with, targets);
+}
+void JumpTable::ReplaceTarget(const char *label, const char *with) {
+  for (unsigned i = 0; i < targets.size(); i++)
+    if (strcmp(targets[i], label) == 0) targets[i] = strdup(with);
+}
 
 BeginFunc::BeginFunc() {
   sprintf(printed,"BeginFunc (unassigned)");
   frameSize = -555; // used as sentinel to recognized unassigned value
+  numParams = 0;
+  leaf = false;
 }
 void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
   frameSize = numBytesForAllLocalsAndTemps; 
@@ -165,6 +313,9 @@ Return::Return(Location *v) : val(v) {
 void Return::EmitSpecific(Mips *mips) {	  
   mips->EmitReturn(val);
 }
+void Return::ReplaceUse(Location *var, Location *with) {
+  *this = Return(with);
+}
 
 PushParam::PushParam(Location *p)
   :  param(p) {
@@ -174,6 +325,9 @@ PushParam::PushParam(Location *p)
 void PushParam::EmitSpecific(Mips *mips) {
   mips->EmitParam(param);
 } 
+void PushParam::ReplaceUse(Location *var, Location *with) {
+  *this = PushParam(with);
+}
 
 PopParams::PopParams(int nb)
   :  numBytes(nb) {
@@ -184,23 +338,33 @@ void PopParams::EmitSpecific(Mips *mips) {
 } 
 
 
-LCall::LCall(const char *l, Location *d)
-  :  label(strdup(l)), dst(d) {
-  sprintf(printed, "%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"", label);
+LCall::LCall(const char *l, Location *d, bool t)
+  :  label(strdup(l)), dst(d), tail(t) {
+  sprintf(printed, "%s%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"",
+	  tail? "Tail " : "", label);
 }
 void LCall::EmitSpecific(Mips *mips) {
-  mips->EmitLCall(dst, label);
+  mips->EmitLCall(dst, label, tail);
+}
+void LCall::ReplaceDst(Location *with) {
+  *this = LCall(label, with, tail);
 }
 
-ACall::ACall(Location *ma, Location *d)
-  : dst(d), methodAddr(ma) {
+ACall::ACall(Location *ma, Location *d, bool t)
+  : dst(d), methodAddr(ma), tail(t) {
   Assert(methodAddr != NULL);
-  sprintf(printed, "%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
-	    methodAddr->GetName());
+  sprintf(printed, "%s%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
+	    tail? "Tail " : "", methodAddr->GetName());
 }
 void ACall::EmitSpecific(Mips *mips) {
-  mips->EmitACall(dst, methodAddr);
+  mips->EmitACall(dst, methodAddr, tail);
 } 
+void ACall::ReplaceUse(Location *var, Location *with) {
+  *this = ACall(with, dst, tail);
+}
+void ACall::ReplaceDst(Location *with) {
+  *this = ACall(methodAddr, with, tail);
+}
 
 VTable::VTable(const char *l, List<const char *> *m)
   : methodLabels(m), label(strdup(l)) {
@@ -23,6 +23,7 @@
 #ifndef _H_tac
 #define _H_tac
 #include <string.h>
+#include <vector>
 
 #include "list.h" // for VTable
 class Mips;
@@ -54,11 +55,12 @@ class Location
 
     const char *GetName() const     { return variableName; }
     const char *GetType() const     { return type; }
-    void SetType(const char* t)     { type = strdup(t); }
+    void SetType(const char* t)     { type = t ? strdup(t) : NULL; }
     const char *GetElemType() const    { return elemType; }
-    void SetElemType(const char* t)     { elemType = strdup(t); }
+    void SetElemType(const char* t)     { elemType = t ? strdup(t) : NULL; }
     Segment GetSegment() const      { return segment; }
     int GetOffset() const           { return offset; }
+    void SetOffset(int o)           { offset = o; }
     Location* GetBase() const       { return base; }
 };
  
@@ -75,6 +77,25 @@ class Instruction {
 	virtual void Print();
 	virtual void EmitSpecific(Mips *mips) = 0;
 	void Emit(Mips *mips);
+
+	  // These support the dataflow analyses done before final code
+	  // generation: GetDst is the variable written by the instruction
+	  // (NULL if none), GetUses appends the variables it reads.
+	virtual Location *GetDst()                   { return NULL; }
+	virtual void GetUses(List<Location*> *uses)  {}
+	virtual bool IsCall()                        { return false; }
+
+	  // Rewrites the instruction so that it reads with wherever it
+	  // used to read var (which must be one of the pointers GetUses
+	  // gave out).
+	virtual void ReplaceUse(Location *var, Location *with) {}
+
+	  // Support copying code: Clone makes an identical instruction,
+	  // ReplaceDst makes it write to with instead of its destination
+	  // and ReplaceLabel renames a Label or retargets a branch.
+	virtual Instruction *Clone() = 0;
+	virtual void ReplaceDst(Location *with) {}
+	virtual void ReplaceLabel(const char *with) {}
 };
 
   
@@ -89,9 +110,12 @@ class Instruction {
   class Load;
   class Store;
   class BinaryOp;
+  class UnaryOp;
   class Label;
   class Goto;
   class IfZ;
+  class IfCmp;
+  class JumpTable;
   class BeginFunc;
   class EndFunc;
   class Return;
@@ -109,6 +133,10 @@ class LoadConstant: public Instruction {
   public:
     LoadConstant(Location *dst, int val);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new LoadConstant(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    int GetValue() const { return val; }
 };
 
 class LoadStringConstant: public Instruction {
@@ -117,6 +145,10 @@ class LoadStringConstant: public Instruction {
   public:
     LoadStringConstant(Location *dst, const char *s);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new LoadStringConstant(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    const char *GetString() const { return str; } // with its quotes
 };
     
 class LoadLabel: public Instruction {
@@ -125,6 +157,10 @@ class LoadLabel: public Instruction {
   public:
     LoadLabel(Location *dst, const char *label);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new LoadLabel(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    const char *GetLabel() const { return label; }
 };
 
 class Assign: public Instruction {
@@ -132,6 +168,12 @@ class Assign: public Instruction {
   public:
     Assign(Location *dst, Location *src);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Assign(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(src); }
+    void ReplaceUse(Location *var, Location *with);
+    Location *GetSrc() const { return src; }
 };
 
 class Load: public Instruction {
@@ -140,6 +182,13 @@ class Load: public Instruction {
   public:
     Load(Location *dst, Location *src, int offset = 0);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Load(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(src); }
+    void ReplaceUse(Location *var, Location *with);
+    Location *GetSrc() const { return src; }
+    int GetOffset() const { return offset; }
 };
 
 class Store: public Instruction {
@@ -148,14 +197,22 @@ class Store: public Instruction {
   public:
     Store(Location *d, Location *s, int offset = 0);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Store(*this); }
+    void GetUses(List<Location*> *uses) { uses->Append(dst); uses->Append(src); }
+    void ReplaceUse(Location *var, Location *with);
+    Location *GetAddr() const { return dst; }
+    Location *GetSrc() const { return src; }
+    int GetOffset() const { return offset; }
 };
 
 class BinaryOp: public Instruction {
 
   public:
-    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or, NumOps} OpCode;
+    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Ne, Less, Le, Gt, Ge, And, Or,
+		  NumOps} OpCode;
     static const char * const opName[NumOps];
     static OpCode OpCodeForName(const char *name);
+    static OpCode Mirror(OpCode code); // same result with op1 and op2 swapped
     
   protected:
     OpCode code;
@@ -163,6 +220,36 @@ class BinaryOp: public Instruction {
   public:
     BinaryOp(OpCode c, Location *dst, Location *op1, Location *op2);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new BinaryOp(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(op1); uses->Append(op2); }
+    void ReplaceUse(Location *var, Location *with);
+    OpCode GetOpCode() const { return code; }
+    Location *GetOp1() const { return op1; }
+    Location *GetOp2() const { return op2; }
+};
+
+class UnaryOp: public Instruction {
+
+  public:
+    typedef enum {Not, NumOps} OpCode;
+    static const char * const opName[NumOps];
+    static OpCode OpCodeForName(const char *name);
+
+  protected:
+    OpCode code;
+    Location *dst, *src;
+  public:
+    UnaryOp(OpCode c, Location *dst, Location *src);
+    void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new UnaryOp(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(src); }
+    void ReplaceUse(Location *var, Location *with);
+    OpCode GetOpCode() const { return code; }
+    Location *GetSrc() const { return src; }
 };
 
 class Label: public Instruction {
@@ -171,6 +258,8 @@ class Label: public Instruction {
     Label(const char *label);
     void Print();
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Label(*this); }
+    void ReplaceLabel(const char *with);
     const char* text() const { return label; }
 };
 
@@ -179,6 +268,8 @@ class Goto: public Instruction {
   public:
     Goto(const char *label);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Goto(*this); }
+    void ReplaceLabel(const char *with);
     const char* branch_label() const { return label; }
 };
 
@@ -188,22 +279,83 @@ class IfZ: public Instruction {
   public:
     IfZ(Location *test, const char *label);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new IfZ(*this); }
+    void ReplaceLabel(const char *with);
+    void GetUses(List<Location*> *uses) { uses->Append(test); }
+    void ReplaceUse(Location *var, Location *with);
     const char* branch_label() const { return label; }
+    Location *GetTest() const { return test; }
+};
+
+  // Conditional branch taken if the relation holds between op1 and op2.
+  // Used for conditions instead of materializing the boolean for IfZ.
+class IfCmp: public Instruction {
+  public:
+    typedef enum {Eq, Ne, Lt, Le, Gt, Ge, NumRelations} Relation;
+    static const char * const relationName[NumRelations];
+    static Relation RelationForName(const char *name);
+    static Relation Negate(Relation rel);
+    static bool Holds(Relation rel, int a, int b);
+
+  protected:
+    Relation rel;
+    Location *op1, *op2;
+    const char *label;
+  public:
+    IfCmp(Relation rel, Location *op1, Location *op2, const char *label);
+    void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new IfCmp(*this); }
+    void ReplaceLabel(const char *with);
+    void GetUses(List<Location*> *uses) { uses->Append(op1); uses->Append(op2); }
+    void ReplaceUse(Location *var, Location *with);
+    const char* branch_label() const { return label; }
+    Relation GetRelation() const { return rel; }
+    Location *GetOp1() const { return op1; }
+    Location *GetOp2() const { return op2; }
+};
+
+  // Indexed jump: control goes to targets[index]. The index must already
+  // be known to be in range, nothing follows it.
+class JumpTable: public Instruction {
+    Location *index;
+    std::vector<const char*> targets;
+  public:
+    JumpTable(Location *index, const std::vector<const char*> &targets);
+    void Print();
+    void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new JumpTable(*this); }
+    void GetUses(List<Location*> *uses) { uses->Append(index); }
+    void ReplaceUse(Location *var, Location *with);
+    void ReplaceTarget(const char *label, const char *with);
+    Location *GetIndex() const { return index; }
+    const std::vector<const char*> &GetTargets() const { return targets; }
 };
 
 class BeginFunc: public Instruction {
     int frameSize;
+    int numParams;
+    bool leaf;
   public:
     BeginFunc();
     // used to backpatch the instruction with frame size once known
     void SetFrameSize(int numBytesForAllLocalsAndTemps);
+    int GetFrameSize() const { return frameSize; }
+    // number of words of parameters the function takes (including this)
+    void SetNumParams(int n) { numParams = n; }
+    int GetNumParams() const { return numParams; }
+    // a leaf function makes no calls other than tail calls (and
+    // builtins done in place, see Mips::IsIntrinsic)
+    void SetLeaf(bool l) { leaf = l; }
+    bool IsLeaf() const { return leaf; }
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new BeginFunc(*this); }
 };
 
 class EndFunc: public Instruction {
   public:
     EndFunc();
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new EndFunc(*this); }
 };
 
 class Return: public Instruction {
@@ -211,35 +363,63 @@ class Return: public Instruction {
   public:
     Return(Location *val);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new Return(*this); }
+    void GetUses(List<Location*> *uses) { if (val) uses->Append(val); }
+    void ReplaceUse(Location *var, Location *with);
+    Location *GetValue() const { return val; }
 };   
 
 class PushParam: public Instruction {
     Location *param;
   public:
     PushParam(Location *param);
+    Location *GetParam() const { return param; }
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new PushParam(*this); }
+    void GetUses(List<Location*> *uses) { uses->Append(param); }
+    void ReplaceUse(Location *var, Location *with);
 }; 
 
 class PopParams: public Instruction {
     int numBytes;
   public:
     PopParams(int numBytesOfParamsToRemove);
+    int GetNumBytes() const { return numBytes; }
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new PopParams(*this); }
 }; 
 
+  // A tail call (made in place of returning its result) pops the
+  // caller's frame and jumps to the callee, so nothing follows it.
 class LCall: public Instruction {
     const char *label;
     Location *dst;
+    bool tail;
   public:
-    LCall(const char *labe, Location *result);
+    LCall(const char *labe, Location *result, bool tail = false);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new LCall(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    bool IsCall() { return true; }
+    bool IsTail() const { return tail; }
+    const char *GetLabel() const { return label; }
 };
 
 class ACall: public Instruction {
     Location *dst, *methodAddr;
+    bool tail;
   public:
-    ACall(Location *meth, Location *result);
+    ACall(Location *meth, Location *result, bool tail = false);
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new ACall(*this); }
+    void ReplaceDst(Location *with);
+    Location *GetDst() { return dst; }
+    void GetUses(List<Location*> *uses) { uses->Append(methodAddr); }
+    void ReplaceUse(Location *var, Location *with);
+    bool IsCall() { return true; }
+    bool IsTail() const { return tail; }
+    Location *GetMethodAddr() const { return methodAddr; }
 };
 
 class VTable: public Instruction {
@@ -249,6 +429,7 @@ class VTable: public Instruction {
     VTable(const char *labelForTable, List<const char *> *methodLabels);
     void Print();
     void EmitSpecific(Mips *mips);
+    Instruction *Clone() { return new VTable(*this); }
 };
 
 